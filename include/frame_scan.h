@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ==== Frame Scanner ====
+// Pulls the routing fields out of a relayed message in place, without
+// building a JSON document. Only top-level keys are looked at; nested
+// values are skipped. String spans point into the original buffer.
+struct FrameFields {
+  const char* type = nullptr;
+  size_t typeLen = 0;
+  const char* id = nullptr;
+  size_t idLen = 0;
+  double lat = 0;
+  double lng = 0;
+  bool hasLat = false;
+  bool hasLng = false;
+  size_t end = 0;  // index of the closing '}'
+};
+
+inline size_t skipSpace(const char* p, size_t i, size_t n) {
+  while (i < n && (p[i] == ' ' || p[i] == '\t' || p[i] == '\n' || p[i] == '\r')) i++;
+  return i;
+}
+
+// i points at the opening quote; returns the index just past the closing one,
+// or 0 if the string is unterminated.
+inline size_t skipString(const char* p, size_t i, size_t n) {
+  for (i++; i < n; i++) {
+    if (p[i] == '\\') i++;
+    else if (p[i] == '"') return i + 1;
+  }
+  return 0;
+}
+
+// Skips any value starting at i; returns the index just past it, or 0.
+inline size_t skipValue(const char* p, size_t i, size_t n) {
+  if (i >= n) return 0;
+  if (p[i] == '"') return skipString(p, i, n);
+  if (p[i] == '{' || p[i] == '[') {
+    int depth = 0;
+    while (i < n) {
+      char c = p[i];
+      if (c == '"') {
+        i = skipString(p, i, n);
+        if (!i) return 0;
+        continue;
+      }
+      if (c == '{' || c == '[') depth++;
+      else if (c == '}' || c == ']') {
+        if (--depth == 0) return i + 1;
+      }
+      i++;
+    }
+    return 0;
+  }
+  size_t start = i;
+  while (i < n && p[i] != ',' && p[i] != '}' && p[i] != ']' &&
+         p[i] != ' ' && p[i] != '\t' && p[i] != '\n' && p[i] != '\r') i++;
+  return i > start ? i : 0;
+}
+
+inline bool spanEquals(const char* p, size_t len, const char* lit) {
+  return len == strlen(lit) && memcmp(p, lit, len) == 0;
+}
+
+inline bool parseNumber(const char* p, size_t len, double& out) {
+  char tmp[32];
+  if (len == 0 || len >= sizeof(tmp)) return false;
+  memcpy(tmp, p, len);
+  tmp[len] = '\0';
+  char* end;
+  out = strtod(tmp, &end);
+  return end == tmp + len;
+}
+
+// The object must be the whole message: only whitespace may follow it.
+inline bool closeFrame(const char* p, size_t i, size_t n, FrameFields& f) {
+  if (skipSpace(p, i + 1, n) != n) return false;
+  f.end = i;
+  return true;
+}
+
+inline bool scanFrame(const uint8_t* data, size_t len, FrameFields& f) {
+  const char* p = (const char*)data;
+  size_t i = skipSpace(p, 0, len);
+  if (i >= len || p[i] != '{') return false;
+  i = skipSpace(p, i + 1, len);
+  if (i < len && p[i] == '}') return closeFrame(p, i, len, f);
+
+  while (i < len) {
+    if (p[i] != '"') return false;
+    size_t keyEnd = skipString(p, i, len);
+    if (!keyEnd) return false;
+    const char* key = p + i + 1;
+    size_t keyLen = keyEnd - i - 2;
+
+    i = skipSpace(p, keyEnd, len);
+    if (i >= len || p[i] != ':') return false;
+    i = skipSpace(p, i + 1, len);
+
+    size_t valEnd = skipValue(p, i, len);
+    if (!valEnd) return false;
+    bool isString = p[i] == '"';
+    const char* val = isString ? p + i + 1 : p + i;
+    size_t valLen = isString ? valEnd - i - 2 : valEnd - i;
+
+    if (isString && spanEquals(key, keyLen, "type")) { f.type = val; f.typeLen = valLen; }
+    else if (isString && spanEquals(key, keyLen, "id")) { f.id = val; f.idLen = valLen; }
+    else if (!isString && spanEquals(key, keyLen, "lat")) f.hasLat = parseNumber(val, valLen, f.lat);
+    else if (!isString && spanEquals(key, keyLen, "lng")) f.hasLng = parseNumber(val, valLen, f.lng);
+
+    i = skipSpace(p, valEnd, len);
+    if (i >= len) return false;
+    if (p[i] == '}') return closeFrame(p, i, len, f);
+    if (p[i] != ',') return false;
+    i = skipSpace(p, i + 1, len);
+  }
+  return false;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ==== Geofences ====
+// Circles and polygons loaded from a JSON file on flash, e.g.
+//
+//   [
+//     { "name": "depot", "lat": 22.5726, "lng": 88.3639, "radius": 150 },
+//     { "name": "site",  "points": [[22.57, 88.36], [22.58, 88.36], [22.58, 88.37]] }
+//   ]
+//
+// Fences are bucketed into a lat/lng grid once at load time, so each fix
+// only tests the fences whose bounding box overlaps its cell. Entering and
+// leaving need a few fixes in a row a margin past the edge, so jitter on
+// the boundary does not produce a stream of events.
+
+struct Geofence {
+  String name;
+  bool circle;
+  double minLat, minLng, maxLat, maxLng;  // bounding box
+  double lat, lng;                        // circle centre / polygon origin
+  float radius;                           // circle only, meters
+  float cosLat;                           // meters-per-degree fix-up for longitude
+  uint16_t firstPoint, pointCount;        // polygon only, into the shared point list
+};
+
+typedef void (*GeofenceHandler)(const Geofence& fence, bool entered, double lat, double lng);
+
+// Replaces all fences with the ones in `path`. Returns false if the file is
+// missing or malformed (an empty array is fine); fences with a missing or
+// out-of-range coordinate are skipped.
+bool geofenceLoad(const char* path);
+
+// Tests one fix and calls onEvent for every fence entered or left since the
+// previous call.
+void geofenceCheck(double lat, double lng, GeofenceHandler onEvent);
+
+size_t geofenceCount();
+
+// Slowest geofenceCheck() so far, in microseconds
+unsigned long geofenceMaxMicros();
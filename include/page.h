@@ -0,0 +1,217 @@
+#pragma once
+
+// Leaflet page served at "/". Shared by the ESP32 firmware (src/main.cpp)
+// and the Linux relay (relay/), so both speak to browsers the same way.
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+// ==== HTML Page ====
+const char htmlPage[] PROGMEM = R"rawliteral(
+<!DOCTYPE html>
+<html>
+<head>
+  <title>Real-Time Location Sharing</title>
+  <meta name="viewport" content="width=device-width, initial-scale=1">
+  <link rel="stylesheet" href="https://unpkg.com/leaflet@1.9.4/dist/leaflet.css" />
+  <style>
+    body { margin:0; font-family: Arial, sans-serif; text-align: center; background: #f4f4f4; }
+    h2 { color: #2c3e50; margin: 10px 0; }
+    #map { height: 80vh; width: 100%; margin: 10px 0; border: 2px solid #2c3e50; border-radius: 10px; }
+    .info { font-size: 18px; padding: 10px; }
+    .custom-pin { background-color: red; border-radius: 50%; width: 14px; height: 14px; display: block; border: 2px solid white; }
+    .client-pin { background-color: blue; border-radius: 50%; width: 14px; height: 14px; display: block; border: 2px solid white; }
+    .self-pin { background-color: green; border-radius: 50%; width: 14px; height: 14px; display: block; border: 2px solid white; }
+  </style>
+</head>
+<body>
+  <h2>Real-Time Location Sharing</h2>
+  <div id="map"></div>
+  <div class="info" id="info">Connecting to server...</div>
+  
+  <script src="https://unpkg.com/leaflet@1.9.4/dist/leaflet.js"></script>
+  <script>
+  // Prompt for user name
+  let userName = prompt("Please enter your name:") || "Anonymous";
+
+  // Generate a random client ID string
+  const clientId = "client_" + Math.random().toString(36).substr(2, 9);
+
+  // Initialize the map centered at [0,0]
+  let map = L.map('map').setView([0, 0], 2);
+  L.tileLayer('https://{s}.tile.openstreetmap.org/{z}/{x}/{y}.png', {
+    attribution: '&copy; OpenStreetMap contributors'
+  }).addTo(map);
+
+  // Marker store
+  let markers = {};
+
+  // Update throttling (overwritten by the server's "config" message)
+  let throttle = { minMove: 5, minInterval: 1000, heartbeat: 30000 };
+  let lastSent = null;
+  let suppressed = 0;
+
+  // Latency samples, reported to the server every 10 s
+  let latency = { n: 0, net: 0, netMax: 0, paint: 0, paintMax: 0, fix: 0, fixMax: 0 };
+
+  function recordLatency(data, recvAt) {
+    let sentAt = data.enq || data.relay;
+    if (!sentAt) return;
+    // Wait for the frame that actually shows the new marker position
+    requestAnimationFrame(function () {
+      let paintAt = Date.now();
+      let net = recvAt - sentAt;
+      let paint = paintAt - recvAt;
+      let fix = paintAt - (data.t || sentAt);
+      // net and fix compare this device's clock with GPS time. A negative
+      // value means the clock runs behind, and averaging it in would hide
+      // real delay, so such samples are dropped whole.
+      if (net < 0 || fix < 0) return;
+      latency.n++;
+      latency.net += net; latency.netMax = Math.max(latency.netMax, net);
+      latency.paint += paint; latency.paintMax = Math.max(latency.paintMax, paint);
+      latency.fix += fix; latency.fixMax = Math.max(latency.fixMax, fix);
+    });
+  }
+
+  setInterval(function () {
+    if (latency.n === 0) return;
+    let body = new URLSearchParams({
+      n: latency.n,
+      netAvg: Math.round(latency.net / latency.n), netMax: latency.netMax,
+      paintAvg: Math.round(latency.paint / latency.n), paintMax: latency.paintMax,
+      fixAvg: Math.round(latency.fix / latency.n), fixMax: latency.fixMax
+    });
+    latency = { n: 0, net: 0, netMax: 0, paint: 0, paintMax: 0, fix: 0, fixMax: 0 };
+    fetch('/latency', { method: 'POST', body: body }).catch(() => {});
+  }, 10000);
+
+  // Draw geofences, if the server has any
+  fetch('/fences').then(r => r.ok ? r.json() : []).then(fences => {
+    fences.forEach(f => {
+      let shape = f.points
+        ? L.polygon(f.points, { color: 'orange' })
+        : L.circle([f.lat, f.lng], { radius: f.radius, color: 'orange' });
+      shape.addTo(map).bindTooltip(f.name || "fence");
+    });
+  }).catch(() => {});
+
+  // Draw the module's route so far
+  fetch('/track.geojson').then(r => r.ok ? r.json() : null).then(track => {
+    if (track) L.geoJSON(track, { style: { color: 'red', weight: 3 } }).addTo(map);
+  }).catch(() => {});
+
+  // WebSocket connection
+  const ws = new WebSocket('ws://' + window.location.host + '/ws');
+
+  ws.onopen = function () {
+    document.getElementById('info').innerHTML = 'Connected to server.';
+    console.log("WebSocket connected. Trying to access geolocation...");
+
+    // Start watching location if allowed
+    if (navigator.geolocation) {
+      navigator.geolocation.watchPosition(sendClientLocation, function (error) {
+        console.error("Geolocation error:", error);
+        alert("Location access failed: " + error.message);
+      }, {
+        enableHighAccuracy: true,
+        maximumAge: 3000,
+        timeout: 5000
+      });
+    } else {
+      console.error("Geolocation not supported by this browser.");
+      alert("Geolocation not supported by this browser.");
+    }
+  };
+
+  ws.onmessage = function (event) {
+    let recvAt = Date.now();
+    let data = JSON.parse(event.data);
+    if (data.type === "config") {
+      throttle = { minMove: data.minMove, minInterval: data.minInterval, heartbeat: data.heartbeat };
+      return;
+    }
+    if (data.type === "geofence") {
+      let verb = data.event === "enter" ? " entered " : " left ";
+      document.getElementById('info').textContent = (data.id || "module") + verb + data.fence;
+      return;
+    }
+    let id = data.id;
+    let lat = data.lat;
+    let lng = data.lng;
+    let type = data.type;
+    let name = data.name || (type === "module" ? "GPS Module" : "Client");
+
+    let iconClass = (type === "module") ? 'custom-pin' : 'client-pin';
+
+    if (markers[id]) {
+      markers[id].setLatLng([lat, lng]);
+    } else {
+      let customIcon = L.divIcon({ className: iconClass });
+      markers[id] = L.marker([lat, lng], { icon: customIcon }).addTo(map).bindPopup(name).openPopup();
+
+      // Zoom to first-time user location (self only)
+      if (id === clientId) {
+        map.setView([lat, lng], 16, { animate: true, duration: 2 });
+      }
+    }
+
+    // Update name in popup
+    if (markers[id].getPopup()) {
+      markers[id].getPopup().setContent(name);
+    }
+
+    recordLatency(data, recvAt);
+  };
+
+  ws.onclose = function () {
+    document.getElementById('info').innerHTML = 'Disconnected from server.';
+  };
+
+  // Distance in meters between two lat/lng pairs (haversine)
+  function distanceMeters(lat1, lng1, lat2, lng2) {
+    const R = 6371000;
+    const toRad = Math.PI / 180;
+    let dLat = (lat2 - lat1) * toRad;
+    let dLng = (lng2 - lng1) * toRad;
+    let a = Math.sin(dLat / 2) * Math.sin(dLat / 2) +
+            Math.cos(lat1 * toRad) * Math.cos(lat2 * toRad) *
+            Math.sin(dLng / 2) * Math.sin(dLng / 2);
+    return 2 * R * Math.atan2(Math.sqrt(a), Math.sqrt(1 - a));
+  }
+
+  function shouldSend(lat, lng, now) {
+    if (!lastSent) return true;
+    let elapsed = now - lastSent.at;
+    if (elapsed < throttle.minInterval) return false;
+    if (elapsed >= throttle.heartbeat) return true;
+    return distanceMeters(lastSent.lat, lastSent.lng, lat, lng) >= throttle.minMove;
+  }
+
+  function sendClientLocation(position) {
+    let lat = position.coords.latitude;
+    let lng = position.coords.longitude;
+    let now = Date.now();
+    if (ws.readyState !== WebSocket.OPEN || !shouldSend(lat, lng, now)) {
+      suppressed++;
+      return;
+    }
+    lastSent = { lat: lat, lng: lng, at: now };
+
+    let message = {
+      type: "client",
+      id: clientId,
+      name: userName,
+      lat: lat,
+      lng: lng,
+      t: position.timestamp,
+      ts: now
+    };
+    ws.send(JSON.stringify(message));
+    console.log("Location sent:", message, "suppressed so far:", suppressed);
+  }
+</script>
+</body>
+</html>
+)rawliteral";
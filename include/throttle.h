@@ -0,0 +1,17 @@
+#pragma once
+
+// ==== Update Throttling ====
+// Shared by the firmware, the relay and the module simulator. A client
+// update is only relayed if it moved at least MIN_MOVE_METERS since the
+// last relayed one, and never more often than MIN_INTERVAL_MS. A stationary
+// client still gets one heartbeat every HEARTBEAT_MS so its marker does not
+// look dead. Servers send these to the page in a "config" message and the
+// page applies them before sending.
+const float MIN_MOVE_METERS = 5.0;
+const unsigned long MIN_INTERVAL_MS = 1000;
+const unsigned long HEARTBEAT_MS = 30000;
+
+// The page has already applied the policy, and network jitter can make its
+// updates arrive a little early. Servers re-check against limits scaled by
+// SERVER_SLACK so they only catch pages that ignore the policy.
+const float SERVER_SLACK = 0.8;
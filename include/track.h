@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ==== Simplified Track ====
+// Fixes first pass a noise gate: jitter within TRACK_NOISE_M of a stop is
+// averaged into one point, and a single fix that jumps away is dropped. The
+// gated points then go through a constant-space sleeve simplifier that
+// keeps a point only where the route bends by more than TRACK_TOLERANCE_M,
+// so every gated point lies within that distance of the drawn line; raw
+// fixes can be up to TRACK_NOISE_M further off. Kept points live in a fixed
+// ring buffer (oldest overwritten first), and exports stream straight out
+// of it.
+
+const float TRACK_TOLERANCE_M = 5.0;
+const float TRACK_NOISE_M = 2 * TRACK_TOLERANCE_M;  // jitter radius around a stop
+const size_t TRACK_CAPACITY = 4096;  // kept points, 12 bytes each
+
+struct TrackPoint {
+  int32_t lat;    // degrees * 1e7
+  int32_t lng;    // degrees * 1e7
+  uint32_t time;  // UTC seconds since 1970, 0 if unknown
+};
+
+enum TrackFormat { TRACK_GEOJSON, TRACK_GPX };
+
+// Cursor for one download. Snapshots the ring at creation so fixes that
+// arrive mid-download don't change what is sent.
+struct TrackExport {
+  TrackFormat format;
+  uint8_t stage = 0;       // header, points, tail, footer, done
+  uint32_t next = 0;       // sequence number of the next kept point
+  uint32_t end = 0;
+  bool hasTail = false;    // the newest fix, not yet decided by the simplifier
+  TrackPoint tail;
+  uint32_t written = 0;    // points emitted so far
+  char line[128];          // the point currently being written out
+  const char* pending = nullptr;  // rest of the current piece, if it did not fit
+  size_t pendingLen = 0;
+};
+
+void trackAdd(double lat, double lng, uint32_t time);
+
+void trackExportBegin(TrackExport& x, TrackFormat format);
+
+// Fills up to maxLen bytes; returns 0 once the document is complete.
+size_t trackExportRead(TrackExport& x, uint8_t* buf, size_t maxLen);
+
+uint32_t trackFixes();  // fixes fed in
+uint32_t trackKept();   // points kept by the simplifier
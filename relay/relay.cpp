@@ -0,0 +1,743 @@
+// Linux relay: subscribes to the /ws stream of many ESP32 tracker modules,
+// keeps a merged latest-position table, and fans it out to browsers that
+// load the same Leaflet page the modules serve.
+//
+//   relay --port 8080 --threads 4 --module lab=192.168.1.50:80 --module ...
+//
+// One thread talks to the modules; each worker thread owns its own epoll
+// set, its own SO_REUSEPORT listening socket and the browsers it accepted.
+// Every outgoing WebSocket frame is encoded once and shared by all workers.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ws.h"
+#include "page.h"
+#include "frame_scan.h"
+#include "throttle.h"
+
+// ==== Settings ====
+const size_t MAX_MESSAGE_LEN = 2048;
+const size_t MAX_ID_LEN = 32;
+const size_t MAX_HTTP_HEAD = 8192;
+const size_t MAX_PENDING_OUT = 256 * 1024;  // per browser, then it is dropped
+const uint64_t RECONNECT_MS = 2000;
+
+typedef std::shared_ptr<const std::string> FramePtr;
+
+static uint64_t nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static FramePtr makeFrame(const std::string& json) {
+  return std::make_shared<const std::string>(wsEncodeFrame(WS_OP_TEXT, json.data(), json.size(), false));
+}
+
+static FramePtr removeFrame(const std::string& id) {
+  return makeFrame("{\"type\":\"remove\",\"id\":\"" + id + "\"}");
+}
+
+// ==== Stats ====
+std::atomic<uint64_t> modulesUp(0);
+std::atomic<uint64_t> browsersUp(0);
+std::atomic<uint64_t> framesIn(0);
+std::atomic<uint64_t> framesOut(0);
+std::atomic<uint64_t> slowDrops(0);
+std::atomic<uint64_t> suppressed(0);
+size_t modulesConfigured = 0;
+
+// ==== Latest-Position Table ====
+// id -> last encoded frame, replayed to every browser that connects. Each
+// row remembers which browser connection wrote it (MODULE_OWNER for rows
+// from upstream), so one browser cannot overwrite or remove another's id.
+const uint64_t MODULE_OWNER = 0;
+
+struct TableEntry {
+  FramePtr frame;
+  uint64_t owner;
+};
+
+std::mutex tableMutex;
+std::unordered_map<std::string, TableEntry> latest;
+std::atomic<uint64_t> nextOwner(1);
+
+// Returns false if the id belongs to someone else.
+static bool tableSet(const std::string& id, const FramePtr& frame, uint64_t owner) {
+  std::lock_guard<std::mutex> lock(tableMutex);
+  auto it = latest.find(id);
+  if (it != latest.end() && it->second.owner != owner) return false;
+  latest[id] = TableEntry{ frame, owner };
+  return true;
+}
+
+// Returns true if the row existed and belonged to `owner`.
+static bool tableErase(const std::string& id, uint64_t owner) {
+  std::lock_guard<std::mutex> lock(tableMutex);
+  auto it = latest.find(id);
+  if (it == latest.end() || it->second.owner != owner) return false;
+  latest.erase(it);
+  return true;
+}
+
+// ==== Workers ====
+struct Browser {
+  int fd;
+  bool upgraded = false;
+  bool closeAfterFlush = false;
+  bool wantWrite = false;
+  std::string head;
+  WsStream ws;
+  std::deque<FramePtr> out;
+  size_t outOff = 0;
+  size_t outBytes = 0;
+  uint64_t owner = 0;     // table owner tag, unique per connection
+  std::string clientId;
+  bool relayed = false;   // last update relayed for clientId, for throttling
+  bool lastHasPos = false;
+  double lastLat = 0, lastLng = 0;
+  uint64_t lastAt = 0;
+};
+
+struct Worker {
+  int epfd = -1;
+  int listenFd = -1;
+  int wakeFd = -1;
+  std::thread thread;
+  std::mutex inboxMutex;
+  std::vector<FramePtr> inbox;
+  std::unordered_map<int, Browser> conns;
+};
+
+std::vector<std::unique_ptr<Worker>> workers;
+
+// Hands a frame to every worker; each one fans it out to its own browsers.
+static void publish(const FramePtr& frame) {
+  for (auto& w : workers) {
+    bool wasEmpty;
+    {
+      std::lock_guard<std::mutex> lock(w->inboxMutex);
+      wasEmpty = w->inbox.empty();
+      w->inbox.push_back(frame);
+    }
+    if (wasEmpty) {
+      uint64_t one = 1;
+      ssize_t r = write(w->wakeFd, &one, sizeof(one));
+      (void)r;
+    }
+  }
+}
+
+static void watch(Worker& w, Browser& c, bool wantWrite) {
+  if (c.wantWrite == wantWrite) return;
+  c.wantWrite = wantWrite;
+  epoll_event ev = {};
+  ev.events = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+  ev.data.fd = c.fd;
+  epoll_ctl(w.epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+static void closeBrowser(Worker& w, int fd) {
+  auto it = w.conns.find(fd);
+  if (it == w.conns.end()) return;
+  if (it->second.upgraded) browsersUp--;
+  std::string clientId = it->second.clientId;
+  uint64_t owner = it->second.owner;
+  epoll_ctl(w.epfd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  w.conns.erase(it);
+
+  if (!clientId.empty() && tableErase(clientId, owner)) publish(removeFrame(clientId));
+}
+
+// Returns false if the frame did not fit and the browser must be dropped.
+static bool enqueue(Browser& c, const FramePtr& frame) {
+  if (c.outBytes + frame->size() > MAX_PENDING_OUT) return false;
+  c.out.push_back(frame);
+  c.outBytes += frame->size();
+  return true;
+}
+
+// Writes as much as the socket takes. Returns false if the browser is gone.
+static bool flush(Worker& w, Browser& c) {
+  while (!c.out.empty()) {
+    iovec iov[64];
+    int n = 0;
+    for (auto it = c.out.begin(); it != c.out.end() && n < 64; ++it, ++n) {
+      size_t off = n == 0 ? c.outOff : 0;
+      iov[n].iov_base = (void*)((*it)->data() + off);
+      iov[n].iov_len = (*it)->size() - off;
+    }
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    ssize_t sent = sendmsg(c.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return false;
+    }
+    c.outBytes -= sent;
+    size_t left = sent;
+    while (left > 0) {
+      size_t rest = c.out.front()->size() - c.outOff;
+      if (left < rest) {
+        c.outOff += left;
+        left = 0;
+      } else {
+        left -= rest;
+        c.out.pop_front();
+        c.outOff = 0;
+      }
+    }
+  }
+  if (c.out.empty() && c.closeAfterFlush) return false;
+  watch(w, c, !c.out.empty());
+  return true;
+}
+
+static std::string statsJson() {
+  size_t tracked;
+  {
+    std::lock_guard<std::mutex> lock(tableMutex);
+    tracked = latest.size();
+  }
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "{\"modules\":%zu,\"modulesUp\":%llu,\"browsers\":%llu,\"tracked\":%zu,"
+           "\"framesIn\":%llu,\"framesOut\":%llu,\"slowDrops\":%llu,\"suppressed\":%llu}",
+           modulesConfigured, (unsigned long long)modulesUp.load(),
+           (unsigned long long)browsersUp.load(), tracked,
+           (unsigned long long)framesIn.load(), (unsigned long long)framesOut.load(),
+           (unsigned long long)slowDrops.load(), (unsigned long long)suppressed.load());
+  return buf;
+}
+
+static FramePtr httpResponse(int status, const char* reason, const char* type,
+                             const char* body, size_t len) {
+  char head[256];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n", status, reason, type, len);
+  auto out = std::make_shared<std::string>(head, n);
+  out->append(body, len);
+  return out;
+}
+
+static FramePtr configFrame() {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "{\"type\":\"config\",\"minMove\":%g,\"minInterval\":%lu,\"heartbeat\":%lu}",
+           MIN_MOVE_METERS, MIN_INTERVAL_MS, HEARTBEAT_MS);
+  return makeFrame(buf);
+}
+
+// Distance in meters between two lat/lng pairs (haversine)
+static double distanceMeters(double lat1, double lng1, double lat2, double lng2) {
+  const double R = 6371000.0, RAD = M_PI / 180.0;
+  double dLat = (lat2 - lat1) * RAD, dLng = (lng2 - lng1) * RAD;
+  double a = sin(dLat / 2) * sin(dLat / 2) +
+             cos(lat1 * RAD) * cos(lat2 * RAD) * sin(dLng / 2) * sin(dLng / 2);
+  return 2 * R * atan2(sqrt(a), sqrt(1 - a));
+}
+
+// Same check as the firmware's acceptClientUpdate(). The interval applies
+// to the connection as a whole, so hopping between ids does not bypass it,
+// and to frames without numeric lat/lng, which can't be checked for movement.
+static bool acceptClientUpdate(Browser& c, const std::string& id, const FrameFields& f) {
+  uint64_t now = nowMs();
+  bool hasPos = f.hasLat && f.hasLng;
+  if (c.relayed) {
+    uint64_t elapsed = now - c.lastAt;
+    if (elapsed < MIN_INTERVAL_MS * SERVER_SLACK) return false;
+    if (id == c.clientId && elapsed < HEARTBEAT_MS * SERVER_SLACK && hasPos && c.lastHasPos &&
+        distanceMeters(c.lastLat, c.lastLng, f.lat, f.lng) < MIN_MOVE_METERS * SERVER_SLACK) {
+      return false;
+    }
+  }
+  c.relayed = true;
+  c.lastHasPos = hasPos;
+  c.lastLat = f.lat;
+  c.lastLng = f.lng;
+  c.lastAt = now;
+  return true;
+}
+
+static void handleBrowserMessage(Worker& w, Browser& c, uint8_t opcode, const std::string& payload) {
+  if (opcode == WS_OP_PING) {
+    enqueue(c, std::make_shared<const std::string>(wsEncodeFrame(WS_OP_PONG, payload.data(), payload.size(), false)));
+    return;
+  }
+  if (opcode == WS_OP_CLOSE) {
+    enqueue(c, std::make_shared<const std::string>(wsEncodeFrame(WS_OP_CLOSE, nullptr, 0, false)));
+    c.closeAfterFlush = true;
+    return;
+  }
+  if (opcode != WS_OP_TEXT) return;
+
+  // Browsers may only announce themselves; module frames come from upstream
+  FrameFields f;
+  if (!scanFrame((const uint8_t*)payload.data(), payload.size(), f)) return;
+  if (!spanEquals(f.type, f.typeLen, "client")) return;
+  if (!f.id || f.idLen == 0 || f.idLen > MAX_ID_LEN) return;
+  // Module ids are "name/id", so a browser id with a '/' could shadow one.
+  // Ids are compared undecoded but pages JSON-decode them, so escapes are
+  // refused too ("a\u002fb" would otherwise be "a/b" on the map).
+  if (memchr(f.id, '/', f.idLen) || memchr(f.id, '\\', f.idLen)) return;
+
+  std::string id(f.id, f.idLen);
+  if (!acceptClientUpdate(c, id, f)) {
+    suppressed++;
+    return;
+  }
+  FramePtr frame = makeFrame(payload);
+  if (!tableSet(id, frame, c.owner)) return;  // another browser has this id
+  if (!c.clientId.empty() && c.clientId != id && tableErase(c.clientId, c.owner)) {
+    publish(removeFrame(c.clientId));
+  }
+  c.clientId = id;
+  publish(frame);
+}
+
+static void handleHttp(Worker& w, Browser& c) {
+  size_t end = c.head.find("\r\n\r\n");
+  HttpRequest req;
+  if (!httpParseRequest(c.head.substr(0, end), req)) {
+    c.closeAfterFlush = true;
+    enqueue(c, httpResponse(400, "Bad Request", "text/plain", "", 0));
+    return;
+  }
+
+  if (req.path == "/ws" && req.headers.count("sec-websocket-key")) {
+    c.ws.in = c.head.substr(end + 4);
+    c.head.clear();
+    c.upgraded = true;
+    browsersUp++;
+    enqueue(c, std::make_shared<const std::string>(wsServerHandshake(req.headers["sec-websocket-key"])));
+    enqueue(c, configFrame());
+
+    std::vector<FramePtr> snapshot;
+    {
+      std::lock_guard<std::mutex> lock(tableMutex);
+      snapshot.reserve(latest.size());
+      for (auto& kv : latest) snapshot.push_back(kv.second.frame);
+    }
+    for (auto& frame : snapshot) {
+      if (!enqueue(c, frame)) break;
+    }
+    return;
+  }
+
+  c.closeAfterFlush = true;
+  if (req.path == "/") {
+    enqueue(c, httpResponse(200, "OK", "text/html", htmlPage, strlen(htmlPage)));
+  } else if (req.path == "/stats") {
+    std::string body = statsJson();
+    enqueue(c, httpResponse(200, "OK", "application/json", body.data(), body.size()));
+  } else {
+    enqueue(c, httpResponse(404, "Not Found", "text/plain", "", 0));
+  }
+}
+
+// Returns false if the browser must be closed.
+static bool onBrowserReadable(Worker& w, Browser& c) {
+  char buf[4096];
+  while (true) {
+    ssize_t n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) return false;
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return false;
+    }
+    if (!c.upgraded) {
+      if (c.closeAfterFlush) continue;  // already answered a plain request
+      c.head.append(buf, n);
+      if (c.head.find("\r\n\r\n") != std::string::npos) {
+        handleHttp(w, c);
+      } else if (c.head.size() > MAX_HTTP_HEAD) {
+        return false;
+      }
+      if (!c.upgraded) continue;
+    } else {
+      c.ws.in.append(buf, n);
+    }
+    bool ok = wsConsume(c.ws, true, MAX_MESSAGE_LEN, [&](uint8_t opcode, const std::string& payload) {
+      handleBrowserMessage(w, c, opcode, payload);
+    });
+    if (!ok) return false;
+  }
+  return flush(w, c);
+}
+
+static void acceptBrowsers(Worker& w) {
+  while (true) {
+    int fd = accept4(w.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(w.epfd, EPOLL_CTL_ADD, fd, &ev);
+    Browser& c = w.conns[fd];
+    c.fd = fd;
+    c.owner = nextOwner++;
+  }
+}
+
+// Delivers everything other threads published since the last wake-up.
+static void fanOut(Worker& w) {
+  uint64_t count;
+  ssize_t r = read(w.wakeFd, &count, sizeof(count));
+  (void)r;
+
+  std::vector<FramePtr> frames;
+  {
+    std::lock_guard<std::mutex> lock(w.inboxMutex);
+    frames.swap(w.inbox);
+  }
+
+  std::vector<int> dead;
+  uint64_t sent = 0;
+  for (auto& kv : w.conns) {
+    Browser& c = kv.second;
+    if (!c.upgraded || c.closeAfterFlush) continue;
+    bool ok = true;
+    for (auto& frame : frames) {
+      if (!enqueue(c, frame)) {
+        slowDrops++;
+        ok = false;
+        break;
+      }
+      sent++;
+    }
+    if (!ok || !flush(w, c)) dead.push_back(kv.first);
+  }
+  framesOut += sent;
+  for (int fd : dead) closeBrowser(w, fd);
+}
+
+static void workerLoop(Worker* w) {
+  epoll_event events[256];
+  while (true) {
+    int n = epoll_wait(w->epfd, events, 256, -1);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == w->listenFd) {
+        acceptBrowsers(*w);
+        continue;
+      }
+      if (fd == w->wakeFd) {
+        fanOut(*w);
+        continue;
+      }
+      auto it = w->conns.find(fd);
+      if (it == w->conns.end()) continue;
+      bool ok = !(events[i].events & (EPOLLHUP | EPOLLERR));
+      if (ok && (events[i].events & EPOLLIN)) ok = onBrowserReadable(*w, it->second);
+      if (ok && (events[i].events & EPOLLOUT)) ok = flush(*w, it->second);
+      if (!ok) closeBrowser(*w, fd);
+    }
+  }
+}
+
+static int listenOn(int port) {
+  int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1, zero = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  sockaddr_in6 addr = {};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1024) < 0) {
+    perror("listen");
+    exit(1);
+  }
+  return fd;
+}
+
+static void startWorkers(int count, int port) {
+  for (int i = 0; i < count; i++) {
+    auto w = std::unique_ptr<Worker>(new Worker());
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    w->listenFd = listenOn(port);
+    w->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = w->listenFd;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listenFd, &ev);
+    ev.data.fd = w->wakeFd;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wakeFd, &ev);
+    workers.push_back(std::move(w));
+  }
+  // Only start threads once the vector is final; publish() walks it
+  for (auto& w : workers) w->thread = std::thread(workerLoop, w.get());
+}
+
+// ==== Modules (upstream) ====
+struct Module {
+  enum State { IDLE, CONNECTING, HANDSHAKE, OPEN };
+  std::string name;  // prefixed to every id the module sends
+  std::string host;
+  std::string port;
+  sockaddr_storage addr;
+  socklen_t addrLen = 0;
+  int fd = -1;
+  State state = IDLE;
+  std::string key;
+  std::string head;
+  WsStream ws;
+  std::unordered_set<std::string> ids;
+  uint64_t retryAt = 0;
+};
+
+std::vector<Module> modules;
+
+static void dropModule(Module& m) {
+  if (m.fd >= 0) close(m.fd);
+  if (m.state == Module::OPEN) {
+    modulesUp--;
+    fprintf(stderr, "module %s disconnected\n", m.name.c_str());
+  }
+  m.fd = -1;
+  m.state = Module::IDLE;
+  m.retryAt = nowMs() + RECONNECT_MS;
+  m.head.clear();
+  m.ws = WsStream();
+  for (auto& id : m.ids) {
+    tableErase(id, MODULE_OWNER);
+    publish(removeFrame(id));
+  }
+  m.ids.clear();
+}
+
+static void connectModule(int epfd, Module& m, size_t index) {
+  m.fd = socket(m.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (connect(m.fd, (sockaddr*)&m.addr, m.addrLen) < 0 && errno != EINPROGRESS) {
+    dropModule(m);
+    return;
+  }
+  m.state = Module::CONNECTING;
+  epoll_event ev = {};
+  ev.events = EPOLLOUT;
+  ev.data.u64 = index;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, m.fd, &ev);
+}
+
+static void handleModuleMessage(Module& m, const std::string& payload) {
+  FrameFields f;
+  if (!scanFrame((const uint8_t*)payload.data(), payload.size(), f)) return;
+  if (!f.id || f.idLen == 0 || spanEquals(f.type, f.typeLen, "config")) return;
+
+  // Every module calls itself "module", so namespace ids by module name
+  size_t idAt = f.id - payload.data();
+  std::string id = m.name + "/" + std::string(f.id, f.idLen);
+  std::string json = payload.substr(0, idAt) + m.name + "/" + payload.substr(idAt);
+  framesIn++;
+
+  // Positions go in the table; events such as geofence crossings are only
+  // passed through
+  FramePtr frame = makeFrame(json);
+  if (spanEquals(f.type, f.typeLen, "remove")) {
+    m.ids.erase(id);
+    tableErase(id, MODULE_OWNER);
+  } else if (spanEquals(f.type, f.typeLen, "module") || spanEquals(f.type, f.typeLen, "client")) {
+    m.ids.insert(id);
+    tableSet(id, frame, MODULE_OWNER);
+  }
+  publish(frame);
+}
+
+static void onModuleEvent(int epfd, Module& m, uint32_t events) {
+  if (m.state == Module::CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(m.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err || (events & (EPOLLERR | EPOLLHUP))) {
+      dropModule(m);
+      return;
+    }
+    std::string req = wsClientHandshake(m.host + ":" + m.port, "/ws", m.key);
+    if (send(m.fd, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size()) {
+      dropModule(m);
+      return;
+    }
+    m.state = Module::HANDSHAKE;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = &m - &modules[0];
+    epoll_ctl(epfd, EPOLL_CTL_MOD, m.fd, &ev);
+    return;
+  }
+
+  char buf[4096];
+  while (true) {
+    ssize_t n = recv(m.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) {
+      dropModule(m);
+      return;
+    }
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      dropModule(m);
+      return;
+    }
+
+    if (m.state == Module::HANDSHAKE) {
+      m.head.append(buf, n);
+      size_t end = m.head.find("\r\n\r\n");
+      if (end == std::string::npos) {
+        if (m.head.size() > MAX_HTTP_HEAD) dropModule(m);
+        if (m.fd < 0) return;
+        continue;
+      }
+      if (!httpIsSwitchingProtocols(m.head.substr(0, end), m.key)) {
+        fprintf(stderr, "module %s refused the WebSocket upgrade\n", m.name.c_str());
+        dropModule(m);
+        return;
+      }
+      m.ws.in = m.head.substr(end + 4);
+      m.head.clear();
+      m.state = Module::OPEN;
+      modulesUp++;
+      fprintf(stderr, "module %s connected\n", m.name.c_str());
+    } else {
+      m.ws.in.append(buf, n);
+    }
+
+    bool closed = false;
+    bool ok = wsConsume(m.ws, false, MAX_MESSAGE_LEN, [&](uint8_t opcode, const std::string& payload) {
+      if (opcode == WS_OP_TEXT) {
+        handleModuleMessage(m, payload);
+      } else if (opcode == WS_OP_PING) {
+        std::string pong = wsEncodeFrame(WS_OP_PONG, payload.data(), payload.size(), true);
+        send(m.fd, pong.data(), pong.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+      } else if (opcode == WS_OP_CLOSE) {
+        closed = true;
+      }
+    });
+    if (!ok || closed) {
+      dropModule(m);
+      return;
+    }
+  }
+}
+
+static void upstreamLoop() {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event events[64];
+  while (true) {
+    uint64_t now = nowMs();
+    for (size_t i = 0; i < modules.size(); i++) {
+      if (modules[i].state == Module::IDLE && modules[i].retryAt <= now) connectModule(epfd, modules[i], i);
+    }
+    int n = epoll_wait(epfd, events, 64, 250);
+    for (int i = 0; i < n; i++) {
+      Module& m = modules[events[i].data.u64];
+      if (m.fd < 0) continue;
+      onModuleEvent(epfd, m, events[i].events);
+    }
+  }
+}
+
+// "name=host:port" or "host:port"
+static bool addModule(const std::string& spec) {
+  Module m;
+  size_t eq = spec.find('=');
+  std::string hostPort = eq == std::string::npos ? spec : spec.substr(eq + 1);
+  size_t colon = hostPort.rfind(':');
+  if (colon == std::string::npos) return false;
+  m.host = hostPort.substr(0, colon);
+  m.port = hostPort.substr(colon + 1);
+  m.name = eq == std::string::npos ? hostPort : spec.substr(0, eq);
+  if (m.name.find_first_of("\"\\") != std::string::npos) return false;
+
+  addrinfo hints = {}, *res;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(m.host.c_str(), m.port.c_str(), &hints, &res) != 0) {
+    fprintf(stderr, "cannot resolve %s\n", hostPort.c_str());
+    return false;
+  }
+  memcpy(&m.addr, res->ai_addr, res->ai_addrlen);
+  m.addrLen = res->ai_addrlen;
+  freeaddrinfo(res);
+  modules.push_back(std::move(m));
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: relay [--port N] [--threads N] --module [name=]host:port ...\n"
+          "             [--module-range host:firstPort:count]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  int port = 8080;
+  int threads = std::thread::hardware_concurrency();
+  if (threads < 1) threads = 1;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) usage();
+    std::string val = argv[++i];
+    if (arg == "--port") {
+      port = atoi(val.c_str());
+    } else if (arg == "--threads") {
+      threads = atoi(val.c_str());
+    } else if (arg == "--module") {
+      if (!addModule(val)) usage();
+    } else if (arg == "--module-range") {
+      size_t a = val.rfind(':');
+      size_t b = a == std::string::npos ? a : val.rfind(':', a - 1);
+      if (b == std::string::npos) usage();
+      std::string host = val.substr(0, b);
+      int first = atoi(val.substr(b + 1, a - b - 1).c_str());
+      int count = atoi(val.substr(a + 1).c_str());
+      for (int p = first; p < first + count; p++) {
+        if (!addModule(host + ":" + std::to_string(p))) usage();
+      }
+    } else {
+      usage();
+    }
+  }
+  if (modules.empty() || threads < 1) usage();
+  modulesConfigured = modules.size();
+
+  signal(SIGPIPE, SIG_IGN);
+  rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+
+  startWorkers(threads, port);
+  fprintf(stderr, "relay listening on :%d with %d workers, %zu modules\n", port, threads, modules.size());
+  upstreamLoop();
+}
@@ -0,0 +1,327 @@
+// Stand-in for a room full of ESP32 tracker modules, and a browser load
+// generator, so the relay can be load-tested on one machine.
+//
+//   module-sim --modules 200 --port 9000 [--interval-ms 1000]
+//       Serves /ws on ports 9000..9199. Each port behaves like one module:
+//       it sends a config frame on connect and then a "module" position
+//       frame every interval, wandering around its start point.
+//
+//   module-sim --browsers 5000 --connect 127.0.0.1:8080 [--seconds 30]
+//       Opens that many WebSocket clients against the relay and prints how
+//       many frames per second they receive in total.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ws.h"
+#include "throttle.h"
+
+const size_t MAX_MESSAGE_LEN = 2048;
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void raiseFdLimit() {
+  rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+}
+
+// ==== Module Simulator ====
+struct SimModule {
+  int listenFd;
+  double lat;
+  double lng;
+  double heading;  // radians
+  std::vector<int> clients;
+};
+
+struct SimConn {
+  int module;
+  bool upgraded = false;
+  std::string head;
+};
+
+static int runModules(int count, int basePort, int intervalMs) {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> unit(-1.0, 1.0);
+
+  // Tag listening sockets with the high bit so they can't collide with fds
+  const uint64_t LISTEN_TAG = 1ull << 63;
+  std::vector<SimModule> mods(count);
+  for (int i = 0; i < count; i++) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(basePort + i);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+      perror("listen");
+      return 1;
+    }
+    mods[i].listenFd = fd;
+    mods[i].lat = 22.5726 + unit(rng) * 0.05;
+    mods[i].lng = 88.3639 + unit(rng) * 0.05;
+    mods[i].heading = unit(rng) * M_PI;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTEN_TAG | i;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  itimerspec its = {};
+  its.it_interval.tv_sec = intervalMs / 1000;
+  its.it_interval.tv_nsec = (long)(intervalMs % 1000) * 1000000;
+  its.it_value = its.it_interval;
+  timerfd_settime(timerFd, 0, &its, nullptr);
+  epoll_event tev = {};
+  tev.events = EPOLLIN;
+  tev.data.u64 = LISTEN_TAG | (uint64_t)count;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &tev);
+
+  std::unordered_map<int, SimConn> conns;
+  fprintf(stderr, "simulating %d modules on 127.0.0.1:%d..%d\n", count, basePort, basePort + count - 1);
+
+  auto dropConn = [&](int fd) {
+    auto it = conns.find(fd);
+    if (it == conns.end()) return;
+    auto& list = mods[it->second.module].clients;
+    for (size_t i = 0; i < list.size(); i++) {
+      if (list[i] == fd) {
+        list[i] = list.back();
+        list.pop_back();
+        break;
+      }
+    }
+    conns.erase(it);
+    close(fd);
+  };
+
+  epoll_event events[256];
+  while (true) {
+    int n = epoll_wait(epfd, events, 256, -1);
+    for (int e = 0; e < n; e++) {
+      uint64_t tag = events[e].data.u64;
+
+      if (tag == (LISTEN_TAG | (uint64_t)count)) {
+        uint64_t ticks;
+        ssize_t r = read(timerFd, &ticks, sizeof(ticks));
+        (void)r;
+        double step = 0.00005;  // roughly 5 m per tick
+        for (auto& m : mods) {
+          m.heading += unit(rng) * 0.3;
+          m.lat += cos(m.heading) * step;
+          m.lng += sin(m.heading) * step;
+          if (m.clients.empty()) continue;
+          char json[128];
+          int len = snprintf(json, sizeof(json),
+                             "{\"type\":\"module\",\"id\":\"module\",\"lat\":%.6f,\"lng\":%.6f}", m.lat, m.lng);
+          std::string frame = wsEncodeFrame(WS_OP_TEXT, json, len, false);
+          std::vector<int> clients = m.clients;
+          for (int fd : clients) {
+            if (send(fd, frame.data(), frame.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0 &&
+                errno != EAGAIN && errno != EWOULDBLOCK) {
+              dropConn(fd);
+            }
+          }
+        }
+        continue;
+      }
+
+      if (tag & LISTEN_TAG) {
+        int module = (int)(tag & ~LISTEN_TAG);
+        int fd;
+        while ((fd = accept4(mods[module].listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+          epoll_event ev = {};
+          ev.events = EPOLLIN;
+          ev.data.u64 = (uint64_t)fd;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+          conns[fd].module = module;
+        }
+        continue;
+      }
+
+      int fd = (int)tag;
+      auto it = conns.find(fd);
+      if (it == conns.end()) continue;
+      SimConn& c = it->second;
+      char buf[2048];
+      ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (r <= 0) {
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+        dropConn(fd);
+        continue;
+      }
+      if (c.upgraded) continue;  // pongs and the like; modules ignore them
+
+      c.head.append(buf, r);
+      size_t end = c.head.find("\r\n\r\n");
+      if (end == std::string::npos) continue;
+      HttpRequest req;
+      if (!httpParseRequest(c.head.substr(0, end), req) || !req.headers.count("sec-websocket-key")) {
+        dropConn(fd);
+        continue;
+      }
+      std::string out = wsServerHandshake(req.headers["sec-websocket-key"]);
+      char config[128];
+      int n = snprintf(config, sizeof(config), "{\"type\":\"config\",\"minMove\":%g,\"minInterval\":%lu,\"heartbeat\":%lu}",
+                       MIN_MOVE_METERS, MIN_INTERVAL_MS, HEARTBEAT_MS);
+      out += wsEncodeFrame(WS_OP_TEXT, config, n, false);
+      send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+      c.upgraded = true;
+      mods[c.module].clients.push_back(fd);
+    }
+  }
+}
+
+// ==== Browser Load Generator ====
+struct LoadClient {
+  bool upgraded = false;
+  std::string key;
+  std::string head;
+  WsStream ws;
+};
+
+static int runBrowsers(int count, const std::string& host, const std::string& port, int seconds) {
+  addrinfo hints = {}, *res;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+    fprintf(stderr, "cannot resolve %s\n", host.c_str());
+    return 1;
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  std::unordered_map<int, LoadClient> clients;
+  for (int i = 0; i < count; i++) {
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+      perror("connect");
+      if (fd >= 0) close(fd);
+      break;
+    }
+    LoadClient& c = clients[fd];
+    std::string req = wsClientHandshake(host + ":" + port, "/ws", c.key);
+    send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+  freeaddrinfo(res);
+  fprintf(stderr, "opened %zu browser connections\n", clients.size());
+
+  uint64_t frames = 0, total = 0, lost = 0;
+  double start = nowSec(), lastReport = start;
+  epoll_event events[256];
+  while (seconds <= 0 || nowSec() - start < seconds) {
+    int n = epoll_wait(epfd, events, 256, 200);
+    for (int e = 0; e < n; e++) {
+      int fd = events[e].data.fd;
+      auto it = clients.find(fd);
+      if (it == clients.end()) continue;
+      LoadClient& c = it->second;
+      char buf[8192];
+      ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (r <= 0) {
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients.erase(fd);
+        lost++;
+        continue;
+      }
+      if (!c.upgraded) {
+        c.head.append(buf, r);
+        size_t end = c.head.find("\r\n\r\n");
+        if (end == std::string::npos) continue;
+        if (!httpIsSwitchingProtocols(c.head.substr(0, end), c.key)) {
+          fprintf(stderr, "relay refused the WebSocket upgrade\n");
+          return 1;
+        }
+        c.upgraded = true;
+        c.ws.in = c.head.substr(end + 4);
+        c.head.clear();
+      } else {
+        c.ws.in.append(buf, r);
+      }
+      wsConsume(c.ws, false, MAX_MESSAGE_LEN, [&](uint8_t opcode, const std::string&) {
+        if (opcode == WS_OP_TEXT) frames++;
+      });
+    }
+
+    double now = nowSec();
+    if (now - lastReport >= 1.0) {
+      total += frames;
+      printf("%.0fs: %.0f frames/s across %zu browsers (%llu dropped)\n",
+             now - start, frames / (now - lastReport), clients.size(), (unsigned long long)lost);
+      fflush(stdout);
+      frames = 0;
+      lastReport = now;
+    }
+  }
+  printf("total %llu frames in %.1fs\n", (unsigned long long)(total + frames), nowSec() - start);
+  return 0;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: module-sim --modules N [--port P] [--interval-ms MS]\n"
+          "       module-sim --browsers N --connect host:port [--seconds S]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  int moduleCount = 0, browserCount = 0, port = 9000, intervalMs = 1000, seconds = 0;
+  std::string target;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) usage();
+    const char* val = argv[++i];
+    if (arg == "--modules") moduleCount = atoi(val);
+    else if (arg == "--browsers") browserCount = atoi(val);
+    else if (arg == "--port") port = atoi(val);
+    else if (arg == "--interval-ms") intervalMs = atoi(val);
+    else if (arg == "--connect") target = val;
+    else if (arg == "--seconds") seconds = atoi(val);
+    else usage();
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  raiseFdLimit();
+
+  if (moduleCount > 0 && intervalMs > 0) return runModules(moduleCount, port, intervalMs);
+  if (browserCount > 0 && !target.empty()) {
+    size_t colon = target.rfind(':');
+    if (colon == std::string::npos) usage();
+    return runBrowsers(browserCount, target.substr(0, colon), target.substr(colon + 1), seconds);
+  }
+  usage();
+}
@@ -0,0 +1,214 @@
+#include "ws.h"
+
+#include <string.h>
+#include <random>
+
+// ==== SHA-1 (only used for Sec-WebSocket-Accept) ====
+static uint32_t rol(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+static void sha1(const std::string& msg, uint8_t out[20]) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+  std::string data = msg;
+  uint64_t bitLen = (uint64_t)msg.size() * 8;
+  data += (char)0x80;
+  while (data.size() % 64 != 56) data += (char)0;
+  for (int i = 7; i >= 0; i--) data += (char)(bitLen >> (i * 8));
+
+  for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t* p = (const uint8_t*)data.data() + chunk + i * 4;
+      w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+      else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+      else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+      else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+      uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d; d = c; c = rol(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+  }
+
+  for (int i = 0; i < 5; i++) {
+    out[i * 4]     = h[i] >> 24;
+    out[i * 4 + 1] = h[i] >> 16;
+    out[i * 4 + 2] = h[i] >> 8;
+    out[i * 4 + 3] = h[i];
+  }
+}
+
+static std::string base64(const uint8_t* p, size_t n) {
+  static const char tbl[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < n; i += 3) {
+    uint32_t v = (uint32_t)p[i] << 16;
+    if (i + 1 < n) v |= (uint32_t)p[i + 1] << 8;
+    if (i + 2 < n) v |= p[i + 2];
+    out += tbl[(v >> 18) & 63];
+    out += tbl[(v >> 12) & 63];
+    out += i + 1 < n ? tbl[(v >> 6) & 63] : '=';
+    out += i + 2 < n ? tbl[v & 63] : '=';
+  }
+  return out;
+}
+
+static std::mt19937& rng() {
+  thread_local std::mt19937 gen(std::random_device{}());
+  return gen;
+}
+
+// ==== HTTP ====
+static std::string lower(std::string s) {
+  for (char& c : s) if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+  return s;
+}
+
+static std::string trim(const std::string& s) {
+  size_t a = s.find_first_not_of(" \t");
+  size_t b = s.find_last_not_of(" \t\r");
+  return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+}
+
+bool httpParseRequest(const std::string& head, HttpRequest& req) {
+  size_t eol = head.find("\r\n");
+  std::string line = head.substr(0, eol);
+  size_t sp1 = line.find(' ');
+  size_t sp2 = line.find(' ', sp1 + 1);
+  if (sp1 == std::string::npos || sp2 == std::string::npos) return false;
+  req.method = line.substr(0, sp1);
+  req.path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+
+  while (eol != std::string::npos) {
+    size_t start = eol + 2;
+    eol = head.find("\r\n", start);
+    std::string h = head.substr(start, eol == std::string::npos ? std::string::npos : eol - start);
+    size_t colon = h.find(':');
+    if (colon == std::string::npos) continue;
+    req.headers[lower(trim(h.substr(0, colon)))] = trim(h.substr(colon + 1));
+  }
+  return true;
+}
+
+bool httpIsSwitchingProtocols(const std::string& head, const std::string& key) {
+  if (head.compare(0, 12, "HTTP/1.1 101") != 0) return false;
+  HttpRequest r;  // same "line + headers" layout as a request
+  httpParseRequest(head, r);
+  return r.headers["sec-websocket-accept"] == wsAcceptKey(key);
+}
+
+// ==== Handshake ====
+std::string wsAcceptKey(const std::string& key) {
+  uint8_t digest[20];
+  sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", digest);
+  return base64(digest, sizeof(digest));
+}
+
+std::string wsServerHandshake(const std::string& key) {
+  return "HTTP/1.1 101 Switching Protocols\r\n"
+         "Upgrade: websocket\r\n"
+         "Connection: Upgrade\r\n"
+         "Sec-WebSocket-Accept: " + wsAcceptKey(key) + "\r\n\r\n";
+}
+
+std::string wsClientHandshake(const std::string& host, const std::string& path, std::string& keyOut) {
+  uint8_t nonce[16];
+  for (uint8_t& b : nonce) b = rng()();
+  keyOut = base64(nonce, sizeof(nonce));
+  return "GET " + path + " HTTP/1.1\r\n"
+         "Host: " + host + "\r\n"
+         "Upgrade: websocket\r\n"
+         "Connection: Upgrade\r\n"
+         "Sec-WebSocket-Key: " + keyOut + "\r\n"
+         "Sec-WebSocket-Version: 13\r\n\r\n";
+}
+
+// ==== Frames ====
+std::string wsEncodeFrame(uint8_t opcode, const char* data, size_t len, bool mask) {
+  std::string out;
+  out.reserve(len + 14);
+  out += (char)(0x80 | opcode);
+  uint8_t maskBit = mask ? 0x80 : 0;
+  if (len < 126) {
+    out += (char)(maskBit | len);
+  } else if (len <= 0xFFFF) {
+    out += (char)(maskBit | 126);
+    out += (char)(len >> 8);
+    out += (char)len;
+  } else {
+    out += (char)(maskBit | 127);
+    for (int i = 7; i >= 0; i--) out += (char)((uint64_t)len >> (i * 8));
+  }
+
+  if (!mask) {
+    out.append(data, len);
+    return out;
+  }
+  uint8_t key[4];
+  for (uint8_t& b : key) b = rng()();
+  out.append((const char*)key, 4);
+  for (size_t i = 0; i < len; i++) out += (char)(data[i] ^ key[i & 3]);
+  return out;
+}
+
+bool wsConsume(WsStream& s, bool expectMasked, size_t maxMessage, const WsMessageHandler& onMessage) {
+  size_t pos = 0;
+  while (true) {
+    const uint8_t* p = (const uint8_t*)s.in.data() + pos;
+    size_t avail = s.in.size() - pos;
+    if (avail < 2) break;
+
+    bool fin = p[0] & 0x80;
+    uint8_t opcode = p[0] & 0x0F;
+    bool masked = p[1] & 0x80;
+    uint64_t len = p[1] & 0x7F;
+    if (masked != expectMasked) return false;
+    size_t hdr = 2;
+    if (len == 126) {
+      if (avail < 4) break;
+      len = (uint64_t)p[2] << 8 | p[3];
+      hdr = 4;
+    } else if (len == 127) {
+      if (avail < 10) break;
+      len = 0;
+      for (int i = 0; i < 8; i++) len = len << 8 | p[2 + i];
+      hdr = 10;
+    }
+    if (len > maxMessage) return false;
+    const uint8_t* key = p + hdr;
+    if (masked) hdr += 4;
+    if (avail < hdr + len) break;
+
+    std::string payload((const char*)p + hdr, (size_t)len);
+    if (masked) {
+      for (size_t i = 0; i < payload.size(); i++) payload[i] ^= key[i & 3];
+    }
+    pos += hdr + len;
+
+    if (opcode >= WS_OP_CLOSE) {
+      // Control frames are never fragmented and may arrive between fragments
+      onMessage(opcode, payload);
+      continue;
+    }
+    // A new data frame may not interrupt a fragmented message, and a
+    // continuation needs one to continue
+    bool open = s.messageOpcode != WS_OP_CONTINUATION;
+    if (opcode == WS_OP_CONTINUATION ? !open : open) return false;
+    if (opcode != WS_OP_CONTINUATION) s.messageOpcode = opcode;
+    if (s.message.size() + payload.size() > maxMessage) return false;
+    s.message += payload;
+    if (fin) {
+      onMessage(s.messageOpcode, s.message);
+      s.message.clear();
+      s.messageOpcode = WS_OP_CONTINUATION;
+    }
+  }
+  s.in.erase(0, pos);
+  return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <string>
+
+// ==== WebSocket Opcodes ====
+const uint8_t WS_OP_CONTINUATION = 0x0;
+const uint8_t WS_OP_TEXT = 0x1;
+const uint8_t WS_OP_BINARY = 0x2;
+const uint8_t WS_OP_CLOSE = 0x8;
+const uint8_t WS_OP_PING = 0x9;
+const uint8_t WS_OP_PONG = 0xA;
+
+// ==== HTTP Request Head ====
+struct HttpRequest {
+  std::string method;
+  std::string path;
+  std::map<std::string, std::string> headers;  // names lower-cased
+};
+
+// Parses everything up to (not including) the blank line.
+bool httpParseRequest(const std::string& head, HttpRequest& req);
+
+// Checks a server's response head to our upgrade request.
+bool httpIsSwitchingProtocols(const std::string& head, const std::string& key);
+
+// ==== Handshake ====
+std::string wsAcceptKey(const std::string& key);
+std::string wsServerHandshake(const std::string& key);
+std::string wsClientHandshake(const std::string& host, const std::string& path, std::string& keyOut);
+
+// ==== Frames ====
+// Server-to-client frames are unmasked; client-to-server frames must be masked.
+std::string wsEncodeFrame(uint8_t opcode, const char* data, size_t len, bool mask);
+
+// Bytes received on one connection, plus the message being reassembled from
+// fragments. wsConsume() eats every complete frame in `in` and calls
+// onMessage once per complete data message or control frame. Returns false
+// on a protocol error or if a message grows past maxMessage. Servers pass
+// expectMasked = true (browsers must mask), clients pass false.
+struct WsStream {
+  std::string in;
+  std::string message;
+  uint8_t messageOpcode = 0;  // WS_OP_CONTINUATION while no message is open
+};
+
+typedef std::function<void(uint8_t opcode, const std::string& payload)> WsMessageHandler;
+
+bool wsConsume(WsStream& s, bool expectMasked, size_t maxMessage, const WsMessageHandler& onMessage);
@@ -0,0 +1,259 @@
+#include "geofence.h"
+
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <math.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// ==== Limits ====
+const double CELL_DEG = 0.01;              // grid cell, roughly 1.1 km
+const size_t MAX_CELLS_PER_FENCE = 64;     // larger fences are tested on every fix
+const size_t MAX_FENCES = 512;
+const size_t MAX_POLYGON_POINTS = 64;
+const float EDGE_MARGIN_M = 10.0;          // hysteresis against GPS jitter at the edge
+const uint8_t CONFIRM_FIXES = 3;           // fixes in a row past the margin before an event
+const float METERS_PER_DEG = 111320.0f;
+
+// ==== State ====
+static std::vector<Geofence> fences;
+static std::vector<float> points;  // polygon vertices as (dLat, dLng) from the fence origin
+static std::unordered_map<uint64_t, std::vector<uint16_t>> grid;
+static std::vector<uint16_t> wideFences;
+static std::vector<uint16_t> inside;  // sorted, fences that contained the last fix
+static std::vector<uint16_t> nowInside;
+static std::vector<uint16_t> candidates;
+
+// Per fence: how many fixes in a row have disagreed with its state
+struct Streak {
+  uint32_t lastFix = 0;
+  uint8_t count = 0;
+};
+static std::vector<Streak> streaks;
+static uint32_t fixNumber = 0;
+static unsigned long maxMicros = 0;
+
+static int32_t cellOf(double deg) {
+  return (int32_t)floor(deg / CELL_DEG);
+}
+
+static uint64_t cellKey(int32_t row, int32_t col) {
+  return (uint64_t)(uint32_t)row << 32 | (uint32_t)col;
+}
+
+static void indexFence(uint16_t i) {
+  const Geofence& f = fences[i];
+  int32_t r0 = cellOf(f.minLat), r1 = cellOf(f.maxLat);
+  int32_t c0 = cellOf(f.minLng), c1 = cellOf(f.maxLng);
+  if ((size_t)(r1 - r0 + 1) * (size_t)(c1 - c0 + 1) > MAX_CELLS_PER_FENCE) {
+    wideFences.push_back(i);
+    return;
+  }
+  for (int32_t r = r0; r <= r1; r++) {
+    for (int32_t c = c0; c <= c1; c++) grid[cellKey(r, c)].push_back(i);
+  }
+}
+
+// Signed distance in meters from the fence edge, positive inside. Offsets
+// are small, so this runs in single precision (the ESP32 has an FPU for
+// float but not for double).
+static float edgeMeters(const Geofence& f, double lat, double lng) {
+  float dLat = (float)(lat - f.lat);
+  float dLng = (float)(lng - f.lng);
+  float ky = METERS_PER_DEG;
+  float kx = METERS_PER_DEG * f.cosLat;
+
+  if (f.circle) {
+    float dy = dLat * ky;
+    float dx = dLng * kx;
+    return f.radius - sqrtf(dx * dx + dy * dy);
+  }
+
+  // Ray casting along the longitude axis for the side, nearest edge for
+  // the distance
+  const float* p = &points[f.firstPoint * 2];
+  bool in = false;
+  float nearest2 = INFINITY;
+  for (uint16_t i = 0, j = f.pointCount - 1; i < f.pointCount; j = i++) {
+    float yi = p[i * 2], xi = p[i * 2 + 1];
+    float yj = p[j * 2], xj = p[j * 2 + 1];
+    if ((yi > dLat) != (yj > dLat) && dLng < (xj - xi) * (dLat - yi) / (yj - yi) + xi) in = !in;
+
+    float ax = (xi - dLng) * kx, ay = (yi - dLat) * ky;
+    float ex = (xj - xi) * kx, ey = (yj - yi) * ky;
+    float len2 = ex * ex + ey * ey;
+    float t = len2 > 0 ? -(ax * ex + ay * ey) / len2 : 0;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    float cx = ax + t * ex, cy = ay + t * ey;
+    nearest2 = std::min(nearest2, cx * cx + cy * cy);
+  }
+  float d = sqrtf(nearest2);
+  return in ? d : -d;
+}
+
+// A fix only enters a fence once it is EDGE_MARGIN_M inside, and only
+// leaves once it is EDGE_MARGIN_M outside, so a unit parked on the edge
+// does not flip on every fix.
+static bool insideAfter(const Geofence& f, bool wasInside, double lat, double lng) {
+  if (wasInside) return edgeMeters(f, lat, lng) > -EDGE_MARGIN_M;
+  if (lat < f.minLat || lat > f.maxLat || lng < f.minLng || lng > f.maxLng) return false;
+  return edgeMeters(f, lat, lng) > EDGE_MARGIN_M;
+}
+
+static bool addCircle(const char* name, double lat, double lng, float radius) {
+  if (radius <= 0) return false;
+  Geofence f;
+  f.name = name;
+  f.circle = true;
+  f.lat = lat;
+  f.lng = lng;
+  f.radius = radius;
+  f.cosLat = cos(lat * M_PI / 180.0);
+  double dLat = radius / METERS_PER_DEG;
+  double dLng = f.cosLat > 0.01f ? dLat / f.cosLat : 180.0;
+  f.minLat = lat - dLat;
+  f.maxLat = lat + dLat;
+  f.minLng = lng - dLng;
+  f.maxLng = lng + dLng;
+  f.firstPoint = f.pointCount = 0;
+  fences.push_back(f);
+  return true;
+}
+
+static bool validLatLng(JsonVariant lat, JsonVariant lng) {
+  if (!lat.is<double>() || !lng.is<double>()) return false;
+  double a = lat, b = lng;
+  return a >= -90 && a <= 90 && b >= -180 && b <= 180;
+}
+
+static bool addPolygon(const char* name, JsonArray pts) {
+  size_t n = pts.size();
+  if (n < 3 || n > MAX_POLYGON_POINTS) return false;
+  for (JsonVariant pt : pts) {
+    if (!validLatLng(pt[0], pt[1])) return false;
+  }
+
+  Geofence f;
+  f.name = name;
+  f.circle = false;
+  f.radius = 0;
+  f.minLat = f.minLng = 1e9;
+  f.maxLat = f.maxLng = -1e9;
+  for (JsonVariant pt : pts) {
+    double lat = pt[0], lng = pt[1];
+    f.minLat = std::min(f.minLat, lat);
+    f.maxLat = std::max(f.maxLat, lat);
+    f.minLng = std::min(f.minLng, lng);
+    f.maxLng = std::max(f.maxLng, lng);
+  }
+  f.lat = f.minLat;
+  f.lng = f.minLng;
+  f.cosLat = cos(f.lat * M_PI / 180.0);
+  f.firstPoint = points.size() / 2;
+  f.pointCount = n;
+  for (JsonVariant pt : pts) {
+    double lat = pt[0], lng = pt[1];
+    points.push_back((float)(lat - f.lat));
+    points.push_back((float)(lng - f.lng));
+  }
+  fences.push_back(f);
+  return true;
+}
+
+bool geofenceLoad(const char* path) {
+  fences.clear();
+  points.clear();
+  grid.clear();
+  wideFences.clear();
+  inside.clear();
+  streaks.clear();
+
+  File file = LittleFS.open(path, "r");
+  if (!file) return false;
+
+  // Parse one fence at a time so memory does not grow with the file
+  bool ok = file.find("[");
+  int c;
+  while ((c = file.peek()) == ' ' || c == '\t' || c == '\r' || c == '\n') file.read();
+  bool empty = c == ']';
+  DynamicJsonDocument doc(4096);
+  while (ok && !empty && fences.size() < MAX_FENCES) {
+    DeserializationError err = deserializeJson(doc, file);
+    if (err) {
+      ok = false;
+      break;
+    }
+    const char* name = doc["name"] | "fence";
+    bool added;
+    if (doc["radius"].is<float>()) {
+      added = validLatLng(doc["lat"], doc["lng"]) &&
+              addCircle(name, doc["lat"], doc["lng"], doc["radius"]);
+    } else {
+      added = addPolygon(name, doc["points"]);
+    }
+    if (!added) Serial.printf("Skipped invalid geofence '%s'\n", name);
+    if (!file.findUntil(",", "]")) break;
+  }
+  file.close();
+
+  for (uint16_t i = 0; i < fences.size(); i++) indexFence(i);
+  streaks.resize(fences.size());
+  return ok;
+}
+
+void geofenceCheck(double lat, double lng, GeofenceHandler onEvent) {
+  if (fences.empty()) return;
+  unsigned long start = micros();
+
+  // Fences we are in stay candidates until the fix is clear of them, even
+  // from a cell they are not listed in
+  candidates.clear();
+  auto cell = grid.find(cellKey(cellOf(lat), cellOf(lng)));
+  if (cell != grid.end()) candidates.insert(candidates.end(), cell->second.begin(), cell->second.end());
+  candidates.insert(candidates.end(), wideFences.begin(), wideFences.end());
+  candidates.insert(candidates.end(), inside.begin(), inside.end());
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+  // A change only counts once CONFIRM_FIXES fixes in a row agree on it
+  fixNumber++;
+  nowInside.clear();
+  for (uint16_t i : candidates) {
+    bool was = std::binary_search(inside.begin(), inside.end(), i);
+    bool now = insideAfter(fences[i], was, lat, lng);
+    if (now != was) {
+      Streak& s = streaks[i];
+      s.count = s.lastFix + 1 == fixNumber ? s.count + 1 : 1;
+      s.lastFix = fixNumber;
+      if (s.count < CONFIRM_FIXES) now = was;
+    }
+    if (now) nowInside.push_back(i);
+  }
+
+  unsigned long took = micros() - start;
+  if (took > maxMicros) maxMicros = took;
+
+  // Both lists are sorted: walk them together to find entries and exits
+  size_t a = 0, b = 0;
+  while (a < inside.size() || b < nowInside.size()) {
+    if (b == nowInside.size() || (a < inside.size() && inside[a] < nowInside[b])) {
+      onEvent(fences[inside[a++]], false, lat, lng);
+    } else if (a == inside.size() || nowInside[b] < inside[a]) {
+      onEvent(fences[nowInside[b++]], true, lat, lng);
+    } else {
+      a++;
+      b++;
+    }
+  }
+  inside.swap(nowInside);
+}
+
+size_t geofenceCount() {
+  return fences.size();
+}
+
+unsigned long geofenceMaxMicros() {
+  return maxMicros;
+}
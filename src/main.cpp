@@ -3,7 +3,17 @@
 #include <ESPAsyncWebServer.h>
 #include <TinyGPSPlus.h>
 #include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <esp_pm.h>
 #include <map>
+#include <memory>
+#include <vector>
+
+#include "page.h"
+#include "frame_scan.h"
+#include "geofence.h"
+#include "track.h"
+#include "throttle.h"
 
 // ==== WiFi Credentials ====
 const char* ssid = "spa";
@@ -18,159 +28,451 @@ TinyGPSPlus gps;
 HardwareSerial gpsSerial(2);  // UART2
 const int RXD2 = 16;
 const int TXD2 = 17;
+const unsigned long GPS_BAUD = 9600;
+const unsigned long GPS_BYTE_US = 10 * 1000000UL / GPS_BAUD;  // 8N1 = 10 bits per byte
+
+// ==== Track Log ====
+// Append-only event log on flash, rotated once it passes TRACK_LOG_MAX bytes
+const char* TRACK_LOG = "/track.log";
+const char* TRACK_LOG_OLD = "/track.old";
+const size_t TRACK_LOG_MAX = 64 * 1024;
+
+// ==== Geofences ====
+const char* FENCES_FILE = "/fences.json";
+
+// ==== GPS Clock ====
+// UTC ms = millis() + clockOffset, estimated from recent NMEA times.
+// Updated from loop() but read by the web server task too; the lock
+// keeps readers from seeing half of a 64-bit offset.
+const size_t CLOCK_SAMPLES = 32;
+int64_t clockSamples[CLOCK_SAMPLES];
+size_t clockCount = 0;
+size_t clockNext = 0;
+int64_t clockOffset = 0;
+bool clockSynced = false;
+portMUX_TYPE clockMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ==== Latency Tracing ====
+// Stages of the newest fix, as millis() readings
+unsigned long sentenceStartMs = 0;  // '$' of the sentence being received
+unsigned long fixRxMs = 0;          // '$' of the sentence that carried the fix
+unsigned long fixParsedMs = 0;      // that sentence fully decoded
+uint32_t fixSentences = 0;          // gps.sentencesWithFix() after the last sentence
+uint64_t fixUtcMs = 0;              // GPS time of the fix itself
+
+// Added to from loop() and the web server task, read by /stats
+portMUX_TYPE latencyMux = portMUX_INITIALIZER_UNLOCKED;
+
+struct LatencyStat {
+  uint32_t count = 0;
+  uint64_t sum = 0;
+  uint32_t max = 0;
+
+  void add(uint32_t v) { addBatch(1, v, v); }
+  void addBatch(uint32_t n, uint32_t avg, uint32_t worst) {
+    portENTER_CRITICAL(&latencyMux);
+    count += n;
+    sum += (uint64_t)avg * n;
+    if (worst > max) max = worst;
+    portEXIT_CRITICAL(&latencyMux);
+  }
+};
+
+// Measured on the module, in ms except textAllUs: AsyncWebSocket gives no
+// completion callback, so the send stage is only timed as far as
+// textAll() handing the frame to each client's queue.
+LatencyStat rxToParse, parseToEnqueue, textAllUs;
+// Reported back by pages
+LatencyStat pageNetwork, pagePaint, pageFixToDisplay;
+
+// ==== Periodic GPS Broadcasting ====
+const unsigned long BROADCAST_INTERVAL_MS = 5000;
+unsigned long lastBroadcast = 0;
+
+// ==== Power ====
+// With EVENT_LOOP, loop() blocks until the GPS UART goes quiet after a
+// burst of sentences (RX timeout), a client disconnects, or the next
+// broadcast is due, instead of spinning on gpsSerial.available().
+const bool EVENT_LOOP = true;
+const uint8_t GPS_RX_TIMEOUT_SYMBOLS = 10;  // byte times of silence that end a burst, ~10.4 ms at 9600
+const unsigned long MAX_SLEEP_MS = 1000;
+
+// Ballpark ESP32-WROOM figures for the current estimate; measure your board.
+// Only loop() is timed: the AsyncTCP, WiFi and UART event tasks count as
+// idle, so the estimate is a floor rather than the real draw.
+const float CPU_ACTIVE_MA = 45.0;  // loop() running
+const float CPU_IDLE_MA = 15.0;    // idle task, clock gated (lower again with DFS)
+const float WIFI_STA_MA = 25.0;    // associated, modem sleep, averaged
+
+TaskHandle_t loopTaskHandle = nullptr;
+bool dfsEnabled = false;
+
+// Set by the UART callback: when the last byte of the burst arrived
+volatile unsigned long gpsBurstEndMs = 0;
+volatile bool gpsBurstPending = false;
+
+// Measured over POWER_WINDOW_MS windows
+const unsigned long POWER_WINDOW_MS = 10000;
+unsigned long powerWindowStart = 0;
+unsigned long busyMicros = 0;
+unsigned long wakeups = 0;
+float loopDutyPct = 100;  // share of wall time spent in loop(), not whole-CPU load
+float wakeupsPerSec = 0;
 
 // ==== Track clients ====
 std::map<uint32_t, String> clientIDs;
 
-// ==== HTML Page ====
-const char htmlPage[] PROGMEM = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-  <title>Real-Time Location Sharing</title>
-  <meta name="viewport" content="width=device-width, initial-scale=1">
-  <link rel="stylesheet" href="https://unpkg.com/leaflet@1.9.4/dist/leaflet.css" />
-  <style>
-    body { margin:0; font-family: Arial, sans-serif; text-align: center; background: #f4f4f4; }
-    h2 { color: #2c3e50; margin: 10px 0; }
-    #map { height: 80vh; width: 100%; margin: 10px 0; border: 2px solid #2c3e50; border-radius: 10px; }
-    .info { font-size: 18px; padding: 10px; }
-    .custom-pin { background-color: red; border-radius: 50%; width: 14px; height: 14px; display: block; border: 2px solid white; }
-    .client-pin { background-color: blue; border-radius: 50%; width: 14px; height: 14px; display: block; border: 2px solid white; }
-    .self-pin { background-color: green; border-radius: 50%; width: 14px; height: 14px; display: block; border: 2px solid white; }
-  </style>
-</head>
-<body>
-  <h2>Real-Time Location Sharing</h2>
-  <div id="map"></div>
-  <div class="info" id="info">Connecting to server...</div>
-  
-  <script src="https://unpkg.com/leaflet@1.9.4/dist/leaflet.js"></script>
-  <script>
-  // Prompt for user name
-  let userName = prompt("Please enter your name:") || "Anonymous";
-
-  // Generate a random client ID string
-  const clientId = "client_" + Math.random().toString(36).substr(2, 9);
-
-  // Initialize the map centered at [0,0]
-  let map = L.map('map').setView([0, 0], 2);
-  L.tileLayer('https://{s}.tile.openstreetmap.org/{z}/{x}/{y}.png', {
-    attribution: '&copy; OpenStreetMap contributors'
-  }).addTo(map);
-
-  // Marker store
-  let markers = {};
-
-  // WebSocket connection
-  const ws = new WebSocket('ws://' + window.location.hostname + '/ws');
-
-  ws.onopen = function () {
-    document.getElementById('info').innerHTML = 'Connected to server.';
-    console.log("WebSocket connected. Trying to access geolocation...");
-
-    // Start watching location if allowed
-    if (navigator.geolocation) {
-      navigator.geolocation.watchPosition(sendClientLocation, function (error) {
-        console.error("Geolocation error:", error);
-        alert("Location access failed: " + error.message);
-      }, {
-        enableHighAccuracy: true,
-        maximumAge: 3000,
-        timeout: 5000
-      });
-    } else {
-      console.error("Geolocation not supported by this browser.");
-      alert("Geolocation not supported by this browser.");
-    }
-  };
+// ==== Update Throttling ====
+// Policy constants are in throttle.h
+struct LastFix {
+  double lat;
+  double lng;
+  bool hasPos;  // lat/lng were numbers
+  unsigned long at;
+};
+std::map<uint32_t, LastFix> lastRelayed;  // keyed by client->id()
 
-  ws.onmessage = function (event) {
-    let data = JSON.parse(event.data);
-    let id = data.id;
-    let lat = data.lat;
-    let lng = data.lng;
-    let type = data.type;
-    let name = data.name || (type === "module" ? "GPS Module" : "Client");
+unsigned long relayedUpdates = 0;
+unsigned long suppressedUpdates = 0;
 
-    let iconClass = (type === "module") ? 'custom-pin' : 'client-pin';
+// ==== Message Reassembly ====
+// Fragmented or multi-packet messages are collected per client, up to
+// MAX_MESSAGE_LEN bytes; anything larger is dropped as a whole.
+const size_t MAX_MESSAGE_LEN = 2048;
+const size_t MAX_ID_LEN = 32;
 
-    if (markers[id]) {
-      markers[id].setLatLng([lat, lng]);
-    } else {
-      let customIcon = L.divIcon({ className: iconClass });
-      markers[id] = L.marker([lat, lng], { icon: customIcon }).addTo(map).bindPopup(name).openPopup();
+struct Reassembly {
+  std::vector<uint8_t> buf;
+  bool overflow = false;
+};
+std::map<uint32_t, Reassembly> pending;  // keyed by WebSocket client id
 
-      // Zoom to first-time user location (self only)
-      if (id === clientId) {
-        map.setView([lat, lng], 16, { animate: true, duration: 2 });
-      }
-    }
+unsigned long droppedMessages = 0;
+
+// ==== Track Log ====
+void appendTrackLog(const String& line) {
+  File f = LittleFS.open(TRACK_LOG, "a");
+  if (!f) return;
+  if (f.size() > TRACK_LOG_MAX) {
+    f.close();
+    LittleFS.remove(TRACK_LOG_OLD);
+    LittleFS.rename(TRACK_LOG, TRACK_LOG_OLD);
+    f = LittleFS.open(TRACK_LOG, "a");
+    if (!f) return;
+  }
+  f.println(line);
+  f.close();
+}
+
+// ==== GPS Time ====
+// UTC milliseconds since 1970 from the last NMEA date/time, or 0 if unknown
+uint64_t gpsEpochMs() {
+  if (!gps.date.isValid() || !gps.time.isValid() || gps.date.year() < 2000) return 0;
+  // Days from civil date (Howard Hinnant's algorithm)
+  int y = gps.date.year(), m = gps.date.month(), d = gps.date.day();
+  y -= m <= 2;
+  int era = y / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  uint32_t days = era * 146097 + doe - 719468;
+  uint32_t secs = days * 86400UL + gps.time.hour() * 3600UL + gps.time.minute() * 60UL + gps.time.second();
+  return (uint64_t)secs * 1000 + gps.time.centisecond() * 10;
+}
+
+// ==== GPS Clock ====
+// NMEA time says when the fix was taken, but the sentence only starts
+// arriving some time later. Each (GPS UTC - millis()) sample is therefore
+// the true offset minus that delay, so the largest recent sample is the
+// best estimate. Keeping a sliding window lets it follow crystal drift.
+void clockSample(uint64_t utcMs, unsigned long at) {
+  clockSamples[clockNext] = (int64_t)utcMs - (int64_t)at;
+  clockNext = (clockNext + 1) % CLOCK_SAMPLES;
+  if (clockCount < CLOCK_SAMPLES) clockCount++;
+  int64_t best = clockSamples[0];
+  for (size_t i = 1; i < clockCount; i++) {
+    if (clockSamples[i] > best) best = clockSamples[i];
+  }
+  portENTER_CRITICAL(&clockMux);
+  clockOffset = best;
+  clockSynced = true;
+  portEXIT_CRITICAL(&clockMux);
+}
+
+// UTC milliseconds for a millis() reading, or 0 before the first GPS time
+uint64_t utcAt(unsigned long ms) {
+  portENTER_CRITICAL(&clockMux);
+  bool synced = clockSynced;
+  int64_t offset = clockOffset;
+  portEXIT_CRITICAL(&clockMux);
+  return synced ? (uint64_t)((int64_t)ms + offset) : 0;
+}
+
+// ==== Track Export ====
+// Streams the simplified track chunk by chunk, never holding the whole
+// document in RAM.
+void sendTrack(AsyncWebServerRequest *request, TrackFormat format, const char* type, const char* filename) {
+  std::shared_ptr<TrackExport> x = std::make_shared<TrackExport>();
+  trackExportBegin(*x, format);
+  AsyncWebServerResponse *response = request->beginChunkedResponse(type,
+    [x](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return trackExportRead(*x, buffer, maxLen);
+    });
+  if (filename) {
+    response->addHeader("Content-Disposition", String("attachment; filename=") + filename);
+  }
+  request->send(response);
+}
+
+// ==== Geofence Events ====
+void onGeofenceEvent(const Geofence& fence, bool entered, double lat, double lng) {
+  DynamicJsonDocument doc(256);
+  doc["type"] = "geofence";
+  doc["id"] = "module";
+  doc["fence"] = fence.name;
+  doc["event"] = entered ? "enter" : "exit";
+  doc["lat"] = lat;
+  doc["lng"] = lng;
+  if (fixUtcMs) doc["t"] = fixUtcMs;
+  String msg;
+  serializeJson(doc, msg);
+  ws.textAll(msg);
+  appendTrackLog(msg);
+  Serial.println("Geofence: " + msg);
+}
 
-    // Update name in popup
-    if (markers[id].getPopup()) {
-      markers[id].getPopup().setContent(name);
+// ==== Throttling Check ====
+// Returns true if this update from connection `client` should be relayed,
+// and records it. The state belongs to the connection rather than the id
+// the page picked, so switching ids neither resets the interval nor leaves
+// entries behind. Frames without numeric lat/lng (the page would still draw
+// "1.5") can't be checked for movement, so they only get the interval limit.
+bool acceptClientUpdate(uint32_t client, bool sameId, const FrameFields& f) {
+  unsigned long now = millis();
+  bool hasPos = f.hasLat && f.hasLng;
+  auto it = lastRelayed.find(client);
+  if (it != lastRelayed.end()) {
+    const LastFix& last = it->second;
+    unsigned long elapsed = now - last.at;
+    if (elapsed < MIN_INTERVAL_MS * SERVER_SLACK) return false;
+    if (elapsed < HEARTBEAT_MS * SERVER_SLACK && sameId && hasPos && last.hasPos &&
+        TinyGPSPlus::distanceBetween(last.lat, last.lng, f.lat, f.lng) < MIN_MOVE_METERS * SERVER_SLACK) {
+      return false;
     }
-  };
+  }
+  lastRelayed[client] = { f.lat, f.lng, hasPos, now };
+  return true;
+}
 
-  ws.onclose = function () {
-    document.getElementById('info').innerHTML = 'Disconnected from server.';
-  };
+// ==== Relay ====
+// Tells every page to drop the marker for `id`.
+void broadcastRemove(const String& id) {
+  DynamicJsonDocument doc(128);
+  doc["type"] = "remove";
+  doc["id"] = id;
+  String msg;
+  serializeJson(doc, msg);
+  ws.textAll(msg);
+}
 
-  function sendClientLocation(position) {
-    let message = {
-      type: "client",
-      id: clientId,
-      name: userName,
-      lat: position.coords.latitude,
-      lng: position.coords.longitude
-    };
-    ws.send(JSON.stringify(message));
-    console.log("Location sent:", message);
+// Handles one complete text message from a client.
+void handleClientMessage(AsyncWebSocketClient *client, const uint8_t *data, size_t len) {
+  FrameFields f;
+  if (!scanFrame(data, len, f)) {
+    Serial.println("JSON parse error from client.");
+    return;
   }
-</script>
-</body>
-</html>
-)rawliteral";
+  const char *msg = (const char *)data;
+  size_t msgLen = len;
+  std::vector<char> stamped;
+
+  if (spanEquals(f.type, f.typeLen, "client")) {
+    if (!f.id || f.idLen == 0 || f.idLen > MAX_ID_LEN) {
+      Serial.println("Client message with missing or oversized id.");
+      return;
+    }
+    // The id is used undecoded; an escape would let "a\u005fb" pose as "a_b"
+    if (memchr(f.id, '\\', f.idLen)) {
+      Serial.println("Client message with an escaped id.");
+      return;
+    }
+    char idBuf[MAX_ID_LEN + 1];
+    memcpy(idBuf, f.id, f.idLen);
+    idBuf[f.idLen] = '\0';
+    String customId(idBuf);
+    auto known = clientIDs.find(client->id());
+    bool sameId = known != clientIDs.end() && known->second == customId;
+    if (!acceptClientUpdate(client->id(), sameId, f)) {
+      suppressedUpdates++;
+      return;
+    }
+    if (known != clientIDs.end() && !sameId) broadcastRemove(known->second);
+    clientIDs[client->id()] = customId;
+
+    // Stamp when we relayed it, so pages can split network from browser time
+    uint64_t relayUtc = utcAt(millis());
+    if (relayUtc) {
+      char stamp[40];
+      int n = snprintf(stamp, sizeof(stamp), ",\"relay\":%llu}", (unsigned long long)relayUtc);
+      stamped.assign(data, data + f.end);
+      stamped.insert(stamped.end(), stamp, stamp + n);
+      msg = stamped.data();
+      msgLen = stamped.size();
+    }
+  }
+
+  ws.textAll(msg, msgLen);
+  relayedUpdates++;
+  Serial.printf("Broadcasted message: %.*s\n", (int)msgLen, msg);
+}
+
+// ==== Power ====
+// Safe to call from other tasks (UART event task, AsyncTCP)
+void wakeLoop() {
+  if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+}
+
+void onGpsReceive() {
+  gpsBurstEndMs = millis() - GPS_RX_TIMEOUT_SYMBOLS * GPS_BYTE_US / 1000;
+  gpsBurstPending = true;
+  wakeLoop();
+}
+
+// Sleeps until there is work, at most until the next broadcast is due
+void waitForWork() {
+  if (gpsSerial.available() > 0) return;
+  unsigned long since = millis() - lastBroadcast;
+  unsigned long wait = since > BROADCAST_INTERVAL_MS ? 0 : BROADCAST_INTERVAL_MS - since + 1;
+  if (wait > MAX_SLEEP_MS) wait = MAX_SLEEP_MS;
+  // A notification given since the last take is kept, so none are lost
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+  wakeups++;
+}
+
+void accountPower(unsigned long busyStart) {
+  busyMicros += micros() - busyStart;
+  unsigned long now = millis();
+  unsigned long window = now - powerWindowStart;
+  if (window < POWER_WINDOW_MS) return;
+  loopDutyPct = busyMicros / (window * 10.0f);
+  wakeupsPerSec = wakeups * 1000.0f / window;
+  busyMicros = 0;
+  wakeups = 0;
+  powerWindowStart = now;
+}
+
+float minimumMilliamps() {
+  float duty = loopDutyPct / 100;
+  return CPU_ACTIVE_MA * duty + CPU_IDLE_MA * (1 - duty) + WIFI_STA_MA;
+}
+
+// ==== Latency Stats ====
+void addLatency(JsonObject parent, const char* name, const LatencyStat& stat) {
+  portENTER_CRITICAL(&latencyMux);
+  LatencyStat s = stat;
+  portEXIT_CRITICAL(&latencyMux);
+  JsonObject o = parent.createNestedObject(name);
+  o["n"] = s.count;
+  o["avg"] = s.count ? (uint32_t)(s.sum / s.count) : 0;
+  o["max"] = s.max;
+}
 
 // ==== WebSocket Event Handler ====
 void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
                AwsEventType type, void *arg, uint8_t *data, size_t len) {
   if (type == WS_EVT_CONNECT) {
     Serial.printf("WebSocket client #%u connected\n", client->id());
+
+    // Tell the page which throttling policy to apply before sending
+    DynamicJsonDocument doc(128);
+    doc["type"] = "config";
+    doc["minMove"] = MIN_MOVE_METERS;
+    doc["minInterval"] = MIN_INTERVAL_MS;
+    doc["heartbeat"] = HEARTBEAT_MS;
+    String msg;
+    serializeJson(doc, msg);
+    client->text(msg);
   }
   else if (type == WS_EVT_DISCONNECT) {
     Serial.printf("WebSocket client #%u disconnected\n", client->id());
-    if (clientIDs.count(client->id())) {
-      DynamicJsonDocument doc(128);
-      doc["type"] = "remove";
-      doc["id"] = clientIDs[client->id()];
-      String msg;
-      serializeJson(doc, msg);
-      ws.textAll(msg);
-      clientIDs.erase(client->id());
+    wakeLoop();  // so loop() frees the client promptly
+    pending.erase(client->id());
+    lastRelayed.erase(client->id());
+    auto known = clientIDs.find(client->id());
+    if (known != clientIDs.end()) {
+      broadcastRemove(known->second);
+      clientIDs.erase(known);
     }
   }
   else if (type == WS_EVT_DATA) {
-    DynamicJsonDocument doc(256);
-    DeserializationError err = deserializeJson(doc, data, len);
-    if (!err) {
-      String msgType = doc["type"];
-      if (msgType == "client") {
-        String customId = doc["id"];
-        clientIDs[client->id()] = customId;
+    AwsFrameInfo *info = (AwsFrameInfo*)arg;
+    if (info->message_opcode != WS_TEXT) return;
+
+    // Common case: the whole message arrived in one frame and one packet
+    if (info->final && info->num == 0 && info->index == 0 && info->len == len) {
+      pending.erase(client->id());
+      handleClientMessage(client, data, len);
+      return;
+    }
+
+    Reassembly &r = pending[client->id()];
+    if (info->num == 0 && info->index == 0) {
+      r.buf.clear();
+      r.overflow = false;
+    }
+    if (!r.overflow) {
+      if (r.buf.size() + len > MAX_MESSAGE_LEN) {
+        r.overflow = true;
+        r.buf.clear();
+        r.buf.shrink_to_fit();
+      } else {
+        r.buf.insert(r.buf.end(), data, data + len);
       }
-      ws.textAll((const char*)data, len);
-      Serial.printf("Broadcasted message: %s\n", data);
-    } else {
-      Serial.println("JSON parse error from client.");
+    }
+
+    // Last packet of the last frame completes the message
+    if (info->final && info->index + len == info->len) {
+      if (r.overflow) {
+        droppedMessages++;
+        Serial.println("Dropped oversized message from client.");
+      } else {
+        handleClientMessage(client, r.buf.data(), r.buf.size());
+      }
+      pending.erase(client->id());
     }
   }
 }
 
 void setup() {
   Serial.begin(115200);
-  gpsSerial.begin(9600, SERIAL_8N1, RXD2, TXD2);
+  gpsSerial.setRxBufferSize(1024);  // room for a few sentences while we're busy elsewhere
+  gpsSerial.begin(GPS_BAUD, SERIAL_8N1, RXD2, TXD2);
+
+  // ==== Event-Driven Loop ====
+  // setup() runs in the same task as loop()
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  if (EVENT_LOOP) {
+    gpsSerial.setRxTimeout(GPS_RX_TIMEOUT_SYMBOLS);
+    gpsSerial.onReceive(onGpsReceive, true);
+
+    // Let the CPU drop to 80 MHz while idle. No light sleep: it would stop
+    // the UART clock and lose NMEA bytes. Needs CONFIG_PM_ENABLE in the core.
+    esp_pm_config_esp32_t pm = {};
+    pm.max_freq_mhz = 240;
+    pm.min_freq_mhz = 80;
+    pm.light_sleep_enable = false;
+    dfsEnabled = esp_pm_configure(&pm) == ESP_OK;
+    Serial.println(dfsEnabled ? "Dynamic frequency scaling on" : "Dynamic frequency scaling not available");
+  }
+
+  // ==== Load Geofences ====
+  if (!LittleFS.begin(true)) {
+    Serial.println("LittleFS mount failed");
+  } else if (geofenceLoad(FENCES_FILE)) {
+    Serial.printf("Loaded %u geofences\n", (unsigned)geofenceCount());
+  } else {
+    Serial.println("No geofences loaded");
+  }
 
   // ==== Connect to WiFi ====
   WiFi.begin(ssid, password);
@@ -180,6 +482,7 @@ void setup() {
     Serial.print(".");
   }
   Serial.println("\nConnected!");
+  WiFi.setSleep(true);  // modem sleep between beacons
   Serial.print("IP Address: ");
   Serial.println(WiFi.localIP());
 
@@ -188,6 +491,75 @@ void setup() {
     request->send_P(200, "text/html", htmlPage);
   });
 
+  // ==== Geofences & Track Log ====
+  server.on("/fences", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (!LittleFS.exists(FENCES_FILE)) {
+      request->send(404);
+      return;
+    }
+    request->send(LittleFS, FENCES_FILE, "application/json");
+  });
+  server.on("/track.log", HTTP_GET, [](AsyncWebServerRequest *request){
+    request->send(LittleFS, TRACK_LOG, "text/plain");
+  });
+
+  // ==== Simplified Track ====
+  server.on("/track.geojson", HTTP_GET, [](AsyncWebServerRequest *request){
+    sendTrack(request, TRACK_GEOJSON, "application/geo+json", nullptr);
+  });
+  server.on("/track.gpx", HTTP_GET, [](AsyncWebServerRequest *request){
+    sendTrack(request, TRACK_GPX, "application/gpx+xml", "track.gpx");
+  });
+
+  // ==== Throttling Stats ====
+  server.on("/stats", HTTP_GET, [](AsyncWebServerRequest *request){
+    DynamicJsonDocument doc(1024);
+    doc["relayed"] = relayedUpdates;
+    doc["suppressed"] = suppressedUpdates;
+    doc["dropped"] = droppedMessages;
+    doc["clients"] = clientIDs.size();
+    doc["geofences"] = geofenceCount();
+    doc["geofenceMaxUs"] = geofenceMaxMicros();
+    doc["trackFixes"] = trackFixes();
+    doc["trackPoints"] = trackKept();
+    doc["clockSynced"] = utcAt(millis()) != 0;
+    JsonObject latency = doc.createNestedObject("latency");
+    addLatency(latency, "rxToParse", rxToParse);
+    addLatency(latency, "parseToEnqueue", parseToEnqueue);
+    addLatency(latency, "textAllUs", textAllUs);
+    addLatency(latency, "pageNetwork", pageNetwork);
+    addLatency(latency, "pagePaint", pagePaint);
+    addLatency(latency, "pageFixToDisplay", pageFixToDisplay);
+    JsonObject power = doc.createNestedObject("power");
+    power["mode"] = EVENT_LOOP ? "event" : "poll";
+    power["dfs"] = dfsEnabled;
+    power["loopDutyPct"] = loopDutyPct;
+    power["wakeupsPerSec"] = wakeupsPerSec;
+    power["estMinMa"] = minimumMilliamps();
+    String json;
+    serializeJson(doc, json);
+    request->send(200, "application/json", json);
+  });
+
+  // ==== Latency Reports from Pages ====
+  // Form fields: n samples, then avg/max in ms for net, paint and fix
+  server.on("/latency", HTTP_POST, [](AsyncWebServerRequest *request){
+    if (!request->hasParam("n", true)) {
+      request->send(400);
+      return;
+    }
+    uint32_t n = request->getParam("n", true)->value().toInt();
+    auto field = [request](const char* name) -> uint32_t {
+      return request->hasParam(name, true) ? request->getParam(name, true)->value().toInt() : 0;
+    };
+    if (n > 0) {
+      pageNetwork.addBatch(n, field("netAvg"), field("netMax"));
+      pagePaint.addBatch(n, field("paintAvg"), field("paintMax"));
+      pageFixToDisplay.addBatch(n, field("fixAvg"), field("fixMax"));
+    }
+    request->send(204);
+  });
+
   // ==== Setup WebSocket ====
   ws.onEvent(onWsEvent);
   server.addHandler(&ws);
@@ -197,15 +569,56 @@ void setup() {
   Serial.println("HTTP & WebSocket server started");
 }
 
-// ==== Periodic GPS Broadcasting ====
-unsigned long lastBroadcast = 0;
-
+// ==== Main Loop ====
 void loop() {
+  if (EVENT_LOOP) waitForWork();
+  unsigned long busyStart = micros();
+
+  // Bytes may have sat in the RX buffer for a whole burst. Back-date each
+  // one from the end of the burst so rx stamps and clock samples stay true.
+  bool fromBurst = gpsBurstPending;
+  gpsBurstPending = false;
+  int queued = gpsSerial.available();
+  unsigned long burstEnd = fromBurst ? gpsBurstEndMs : millis();
+  int index = 0;
+
   while (gpsSerial.available() > 0) {
-    gps.encode(gpsSerial.read());
+    char c = gpsSerial.read();
+    if (c == '$') {
+      sentenceStartMs = index < queued
+        ? burstEnd - (queued - index) * GPS_BYTE_US / 1000
+        : millis();
+    }
+    index++;
+    if (!gps.encode(c)) continue;
+
+    // A sentence just completed. TinyGPS++'s isUpdated() flags stay set
+    // until the value is read, so they can't tell whether this sentence or
+    // an earlier one in the burst carried the fix; the fix counter can.
+    bool hadFix = gps.sentencesWithFix() != fixSentences;
+    fixSentences = gps.sentencesWithFix();
+    if (gps.time.isUpdated()) {
+      gps.time.value();  // clears the flag even if gpsEpochMs() gives up early
+      uint64_t utc = gpsEpochMs();
+      if (utc) clockSample(utc, sentenceStartMs);
+      if (hadFix) {
+        fixUtcMs = utc;
+        fixRxMs = sentenceStartMs;
+        fixParsedMs = millis();
+        rxToParse.add(fixParsedMs - fixRxMs);
+      }
+    }
+  }
+
+  // Only fences near the fix are tested, so this is cheap even at 10 Hz
+  if (gps.location.isUpdated() && gps.location.isValid()) {
+    double lat = gps.location.lat();
+    double lng = gps.location.lng();
+    geofenceCheck(lat, lng, onGeofenceEvent);
+    trackAdd(lat, lng, fixUtcMs / 1000);
   }
 
-  if (millis() - lastBroadcast > 5000) {
+  if (millis() - lastBroadcast > BROADCAST_INTERVAL_MS) {
     lastBroadcast = millis();
     DynamicJsonDocument doc(256);
     doc["type"] = "module";
@@ -217,9 +630,24 @@ void loop() {
       doc["lat"] = 0;
       doc["lng"] = 0;
     }
+
+    // Per-stage UTC stamps: fix taken, UART receive, parsed, enqueued
+    unsigned long enqueueMs = millis();
+    if (clockSynced && fixUtcMs) {
+      doc["t"] = fixUtcMs;
+      doc["rx"] = utcAt(fixRxMs);
+      doc["parse"] = utcAt(fixParsedMs);
+      doc["enq"] = utcAt(enqueueMs);
+      parseToEnqueue.add(enqueueMs - fixParsedMs);
+    }
     String json;
     serializeJson(doc, json);
+    unsigned long textAllStart = micros();
     ws.textAll(json);
+    textAllUs.add(micros() - textAllStart);
     Serial.println("Sent GPS location: " + json);
   }
+
+  ws.cleanupClients();
+  accountPower(busyStart);
 }
@@ -0,0 +1,288 @@
+#include "track.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+const float METERS_PER_DEG = 111320.0f;
+
+// ==== Ring Buffer ====
+// Written from loop(), read by the web server task during downloads; the
+// lock only covers copying single points in and out.
+static TrackPoint ring[TRACK_CAPACITY];
+static uint32_t keptCount = 0;  // sequence number of the next kept point
+static uint32_t fixCount = 0;
+static TrackPoint tail;         // newest fix, while the simplifier holds it
+static bool tailValid = false;
+static portMUX_TYPE trackMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ==== Noise Gate State ====
+// Fixes within TRACK_NOISE_M of the running mean of the current spot are
+// averaged into it. A fix outside is held back until the next fix agrees
+// that the unit moved; a lone outlier is dropped.
+static int64_t spotLat = 0, spotLng = 0;  // sums, degrees * 1e7
+static uint32_t spotCount = 0;
+static uint32_t spotTime = 0;             // first fix at this spot
+static TrackPoint outlier;
+static bool haveOutlier = false;
+
+// ==== Simplifier State ====
+// Sleeve (cone) simplification in constant space over the gated points:
+// from the anchor, every point further out than the tolerance allows a fan
+// of directions whose ray passes within TRACK_TOLERANCE_M of it. The fans
+// are intersected as points arrive, and a segment can stand in for them all
+// as long as the newest point lies inside the common cone and is at least
+// as far out as any point before it.
+static bool haveAnchor = false;
+static TrackPoint anchor;
+static float anchorCosLat = 1;
+static TrackPoint last;              // newest point covered by the current cone
+static bool haveCone = false;
+static float coneRef = 0;            // bearing of the first point outside the tolerance
+static float coneLo = 0, coneHi = 0; // allowed bearings, relative to coneRef
+static float farthest = 0;           // largest distance from the anchor so far
+
+static void keep(const TrackPoint& p) {
+  portENTER_CRITICAL(&trackMux);
+  ring[keptCount % TRACK_CAPACITY] = p;
+  keptCount++;
+  portEXIT_CRITICAL(&trackMux);
+}
+
+static void setTail(const TrackPoint* p) {
+  portENTER_CRITICAL(&trackMux);
+  tailValid = p != nullptr;
+  if (p) tail = *p;
+  portEXIT_CRITICAL(&trackMux);
+}
+
+static void setAnchor(const TrackPoint& p) {
+  anchor = p;
+  anchorCosLat = cos(p.lat * 1e-7 * M_PI / 180.0);
+  haveCone = false;
+  farthest = 0;
+}
+
+// Offset of q from the anchor in meters, on a flat projection around the
+// anchor (fine over the few kilometers a segment spans).
+static void offsetMeters(const TrackPoint& q, float& x, float& y) {
+  x = (float)((int64_t)q.lng - anchor.lng) * 1e-7f * METERS_PER_DEG * anchorCosLat;
+  y = (float)((int64_t)q.lat - anchor.lat) * 1e-7f * METERS_PER_DEG;
+}
+
+static float distanceMeters(const TrackPoint& a, const TrackPoint& b) {
+  float x = (float)((int64_t)b.lng - a.lng) * 1e-7f * METERS_PER_DEG * anchorCosLat;
+  float y = (float)((int64_t)b.lat - a.lat) * 1e-7f * METERS_PER_DEG;
+  return sqrtf(x * x + y * y);
+}
+
+// Narrows the cone to take in p. Returns false, leaving the cone alone, if
+// no segment from the anchor ending at p covers the points before it.
+static bool coneAdd(const TrackPoint& p) {
+  float x, y;
+  offsetMeters(p, x, y);
+  float d = sqrtf(x * x + y * y);
+  // Each earlier point is within the tolerance of the ray; it is only
+  // within the tolerance of the segment if the segment reaches past it
+  if (d < farthest) return false;
+  if (d > TRACK_TOLERANCE_M) {
+    float bearing = atan2f(y, x);
+    float halfWidth = asinf(TRACK_TOLERANCE_M / d);
+    if (!haveCone) {
+      haveCone = true;
+      coneRef = bearing;
+      coneLo = -halfWidth;
+      coneHi = halfWidth;
+    } else {
+      float rel = remainderf(bearing - coneRef, 2 * (float)M_PI);
+      if (rel < coneLo || rel > coneHi) return false;
+      if (rel - halfWidth > coneLo) coneLo = rel - halfWidth;
+      if (rel + halfWidth < coneHi) coneHi = rel + halfWidth;
+    }
+  }
+  farthest = d;
+  return true;
+}
+
+// Feeds one gated point to the simplifier. When it does not fit, the last
+// covered point ends the segment and starts the next one, which always
+// takes p.
+static void simplify(const TrackPoint& p) {
+  if (!coneAdd(p)) {
+    keep(last);
+    setAnchor(last);
+    coneAdd(p);
+  }
+  last = p;
+}
+
+static TrackPoint spotMean() {
+  return { (int32_t)(spotLat / spotCount), (int32_t)(spotLng / spotCount), spotTime };
+}
+
+static void spotStart(const TrackPoint& p) {
+  spotLat = p.lat;
+  spotLng = p.lng;
+  spotCount = 1;
+  spotTime = p.time;
+}
+
+static void spotAdd(const TrackPoint& p) {
+  spotLat += p.lat;
+  spotLng += p.lng;
+  spotCount++;
+}
+
+void trackAdd(double lat, double lng, uint32_t time) {
+  TrackPoint p = { (int32_t)lround(lat * 1e7), (int32_t)lround(lng * 1e7), time };
+  fixCount++;
+
+  if (!haveAnchor) {
+    haveAnchor = true;
+    setAnchor(p);
+    keep(p);
+    spotStart(p);
+    setTail(nullptr);
+    return;
+  }
+  setTail(&p);
+
+  if (distanceMeters(spotMean(), p) <= TRACK_NOISE_M) {
+    haveOutlier = false;
+    spotAdd(p);
+    return;
+  }
+  if (!haveOutlier) {
+    outlier = p;
+    haveOutlier = true;
+    return;
+  }
+
+  // Two fixes in a row away from the spot: the unit has moved on
+  simplify(spotMean());
+  spotStart(outlier);
+  if (distanceMeters(outlier, p) <= TRACK_NOISE_M) {
+    haveOutlier = false;
+    spotAdd(p);
+  } else {
+    outlier = p;
+  }
+}
+
+// ==== Export ====
+static const char GEOJSON_HEADER[] =
+  "{\"type\":\"Feature\",\"properties\":{\"name\":\"module\"},"
+  "\"geometry\":{\"type\":\"LineString\",\"coordinates\":[";
+static const char GEOJSON_FOOTER[] = "]}}\n";
+static const char GPX_HEADER[] =
+  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+  "<gpx version=\"1.1\" creator=\"GPS-with-ESP\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+  "<trk><name>module</name><trkseg>\n";
+static const char GPX_FOOTER[] = "</trkseg></trk></gpx>\n";
+
+void trackExportBegin(TrackExport& x, TrackFormat format) {
+  x = TrackExport();
+  x.format = format;
+  portENTER_CRITICAL(&trackMux);
+  x.end = keptCount;
+  x.next = keptCount > TRACK_CAPACITY ? keptCount - TRACK_CAPACITY : 0;
+  x.hasTail = tailValid;
+  x.tail = tail;
+  portEXIT_CRITICAL(&trackMux);
+}
+
+static bool readPoint(TrackExport& x, TrackPoint& p) {
+  bool ok;
+  portENTER_CRITICAL(&trackMux);
+  // Skip whatever was overwritten while the download was in progress
+  uint32_t oldest = keptCount > TRACK_CAPACITY ? keptCount - TRACK_CAPACITY : 0;
+  if (x.next < oldest) x.next = oldest;
+  ok = x.next < x.end;
+  if (ok) p = ring[x.next++ % TRACK_CAPACITY];
+  portEXIT_CRITICAL(&trackMux);
+  return ok;
+}
+
+// Fixed-point to text without going through double formatting
+static void formatCoord(char* out, size_t n, int32_t v) {
+  uint32_t a = v < 0 ? (uint32_t)(-(int64_t)v) : (uint32_t)v;
+  snprintf(out, n, "%s%lu.%07lu", v < 0 ? "-" : "",
+           (unsigned long)(a / 10000000), (unsigned long)(a % 10000000));
+}
+
+static size_t formatPoint(TrackExport& x, const TrackPoint& p) {
+  char lat[16], lng[16];
+  formatCoord(lat, sizeof(lat), p.lat);
+  formatCoord(lng, sizeof(lng), p.lng);
+  int n;
+  if (x.format == TRACK_GEOJSON) {
+    n = snprintf(x.line, sizeof(x.line), "%s[%s,%s]", x.written ? "," : "", lng, lat);
+  } else if (p.time) {
+    time_t t = p.time;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    n = snprintf(x.line, sizeof(x.line),
+                 "<trkpt lat=\"%s\" lon=\"%s\"><time>%04d-%02d-%02dT%02d:%02d:%02dZ</time></trkpt>\n",
+                 lat, lng, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+  } else {
+    n = snprintf(x.line, sizeof(x.line), "<trkpt lat=\"%s\" lon=\"%s\"/>\n", lat, lng);
+  }
+  x.written++;
+  return n < (int)sizeof(x.line) ? n : sizeof(x.line) - 1;
+}
+
+size_t trackExportRead(TrackExport& x, uint8_t* buf, size_t maxLen) {
+  size_t len = 0;
+  while (len < maxLen) {
+    if (x.pendingLen > 0) {
+      size_t n = x.pendingLen < maxLen - len ? x.pendingLen : maxLen - len;
+      memcpy(buf + len, x.pending, n);
+      len += n;
+      x.pending += n;
+      x.pendingLen -= n;
+      continue;
+    }
+
+    bool gpx = x.format == TRACK_GPX;
+    TrackPoint p;
+    switch (x.stage) {
+      case 0:  // header
+        x.pending = gpx ? GPX_HEADER : GEOJSON_HEADER;
+        x.pendingLen = gpx ? sizeof(GPX_HEADER) - 1 : sizeof(GEOJSON_HEADER) - 1;
+        x.stage = 1;
+        break;
+      case 1:  // kept points
+        if (readPoint(x, p)) {
+          x.pendingLen = formatPoint(x, p);
+          x.pending = x.line;
+        } else {
+          x.stage = 2;
+        }
+        break;
+      case 2:  // newest fix, so the route reaches the current position
+        if (x.hasTail) {
+          x.pendingLen = formatPoint(x, x.tail);
+          x.pending = x.line;
+        }
+        x.stage = 3;
+        break;
+      case 3:  // footer
+        x.pending = gpx ? GPX_FOOTER : GEOJSON_FOOTER;
+        x.pendingLen = gpx ? sizeof(GPX_FOOTER) - 1 : sizeof(GEOJSON_FOOTER) - 1;
+        x.stage = 4;
+        break;
+      default:
+        return len;
+    }
+  }
+  return len;
+}
+
+uint32_t trackFixes() {
+  return fixCount;
+}
+
+uint32_t trackKept() {
+  return keptCount;
+}